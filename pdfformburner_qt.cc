@@ -1,14 +1,52 @@
 #include <QtCore/QCoreApplication>
 #include <QtCore/QCommandLineParser>
 #include <QtCore/QDateTime>
+#include <QtCore/QBuffer>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
 #include <iostream>
 #include <poppler-qt5.h>
 #include <poppler-form.h>
+#include <poppler/PDFDocFactory.h>
+#include <poppler/PDFDoc.h>
+#include <poppler/Catalog.h>
+#include <poppler/FileSpec.h>
+#include <poppler/Stream.h>
+#include <poppler/XRef.h>
+#include <goo/GooString.h>
+#include <goo/gfile.h>
 #include <memory>
 #include <fstream>
+#include <cctype>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 #include <yaml-cpp/yaml.h>
 #include <fmt/core.h>
 #include <fmt/ostream.h>
+#include <zlib.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <csignal>
+#include <unistd.h>
+#include <utime.h>
 
 static std::ostream & operator<< (std::ostream & os, const QString & string)
 {
@@ -19,11 +57,18 @@ YAML::Emitter& operator << (YAML::Emitter& out, const QString & string)
 	return out << string.toStdString();
 }
 
+// Batch stages report from several threads, keep lines whole
+static std::mutex logMutex;
+static void lockLog() { logMutex.lock(); }
+static void unlockLog() { logMutex.unlock(); }
+
 template<typename ...Args>
 static void colorize(std::ostream & os, const std::string color, const std::string prefix, const std::string & message, Args ... args) { 
+	std::string text = fmt::format(message, args...);
+	std::lock_guard<std::mutex> lock(logMutex);
 	os
 		<< "\033[" << color << "m" << prefix
-		<< fmt::format(message, args...)
+		<< text
 		<< "\033[0m"
 		<< std::endl;
 }
@@ -97,76 +142,813 @@ QString translate(const char * text) {
 }
 
 
-void dump(Poppler::FormFieldButton * field, YAML::Emitter & out) {
+/// Writes extractions as YAML::Emitter lays them out, for the few
+/// shapes they have: block maps and sequences, scalars, literal blocks
+/// and comments. Text is encoded as UTF-8 straight from the QString data
+/// into the buffer, which callers can reuse from one document to the next.
+class YamlWriter {
+public:
+	YamlWriter(std::string & buffer) : _out(buffer), _lineStart(buffer.size()) {}
+
+	void comment(const QString & text) {
+		if (column()) _out.append("  ");
+		std::size_t indent = column();
+		_out.append("# ");
+		_inlineValue = false;
+		appendLines(text, [&]() {
+			newline();
+			_out.append(indent, ' ');
+			_out.append("# ");
+		});
+	}
+
+	void newline() {
+		_out += '\n';
+		_lineStart = _out.size();
+		_inlineValue = false;
+	}
+
+	void beginMap() { beginGroup(true); }
+	void endMap() { endGroup("{}"); }
+	void beginSeq() { beginGroup(false); }
+	void endSeq() { endGroup("[]"); }
+
+	void key(const QString & text) {
+		startKey();
+		appendScalar(text);
+		endKey();
+	}
+	void key(const char * text) {
+		startKey();
+		_out.append(text);
+		endKey();
+	}
+
+	void value(const QString & text) {
+		startValue();
+		appendScalar(text);
+	}
+	/// Only for texts known to be plain scalars
+	void value(const char * text) {
+		startValue();
+		_out.append(text);
+	}
+	void value(bool value) {
+		startValue();
+		_out.append(value? "true" : "false");
+	}
+	void value(int value) {
+		startValue();
+		_out.append(std::to_string(value));
+	}
+	void null() {
+		startValue();
+		_out += '~';
+	}
+
+	/// Same layout as yaml-cpp 0.6, which also indents empty lines
+	void literal(const QString & text) {
+		startValue();
+		_out += '|';
+		newline();
+		std::size_t indent = _groups.back().indent + 2;
+		_out.append(indent, ' ');
+		appendLines(text, [&]() {
+			newline();
+			_out.append(indent, ' ');
+		});
+	}
+
+private:
+	struct Group {
+		bool map;
+		std::size_t indent;
+		unsigned children;
+	};
+
+	std::size_t column() const { return _out.size() - _lineStart; }
+
+	void startLine(std::size_t indent) {
+		if (column()) newline();
+		if (column() < indent) _out.append(indent - column(), ' ');
+	}
+
+	void beginGroup(bool map) {
+		std::size_t indent = _groups.empty()? 0 : _groups.back().indent + 2;
+		_groups.push_back({map, indent, 0});
+		_inlineValue = false;
+	}
+
+	void endGroup(const char * empty) {
+		if (not _groups.back().children) {
+			startLine(_groups.back().indent);
+			_out.append(empty);
+		}
+		_groups.pop_back();
+	}
+
+	void startKey() {
+		startLine(_groups.back().indent);
+		_groups.back().children++;
+	}
+
+	void endKey() {
+		_out += ':';
+		_inlineValue = true;
+	}
+
+	void startValue() {
+		Group & group = _groups.back();
+		if (not group.map) {
+			startLine(group.indent);
+			_out.append("- ");
+			group.children++;
+		}
+		else if (_inlineValue) {
+			_out += ' ';
+		}
+		else {
+			startLine(group.indent + 2);
+		}
+		_inlineValue = false;
+	}
+
+	template <typename Separator>
+	void appendLines(const QString & text, Separator separator) {
+		const ushort * data = text.utf16();
+		int size = text.size();
+		int begin = 0;
+		for (int i = 0; i < size; i++) {
+			if (data[i] != '\n') continue;
+			appendUtf8(data+begin, i-begin);
+			separator();
+			begin = i+1;
+		}
+		appendUtf8(data+begin, size-begin);
+	}
+
+	/// Lone surrogates become '?' as in QString::toUtf8
+	void appendUtf8(const ushort * data, int size) {
+		std::size_t used = _out.size();
+		_out.resize(used + 3*size);
+		char * out = &_out[used];
+		for (int i = 0; i < size; i++) {
+			unsigned c = data[i];
+			if (c < 0x80) {
+				*out++ = char(c);
+				continue;
+			}
+			if (c < 0x800) {
+				*out++ = char(0xC0 | c >> 6);
+				*out++ = char(0x80 | (c & 0x3F));
+				continue;
+			}
+			if (c >= 0xD800 and c < 0xE000) {
+				if (c >= 0xDC00 or i+1 == size or data[i+1] < 0xDC00 or data[i+1] >= 0xE000) {
+					*out++ = '?';
+					continue;
+				}
+				c = 0x10000 + ((c - 0xD800) << 10) + (data[++i] - 0xDC00);
+				*out++ = char(0xF0 | c >> 18);
+				*out++ = char(0x80 | (c >> 12 & 0x3F));
+				*out++ = char(0x80 | (c >> 6 & 0x3F));
+				*out++ = char(0x80 | (c & 0x3F));
+				continue;
+			}
+			*out++ = char(0xE0 | c >> 12);
+			*out++ = char(0x80 | (c >> 6 & 0x3F));
+			*out++ = char(0x80 | (c & 0x3F));
+		}
+		_out.resize(out - &_out[0]);
+	}
+
+	/// Writes the text plain when yaml-cpp would, else double quoted
+	void appendScalar(const QString & text) {
+		std::size_t start = _out.size();
+		appendUtf8(text.utf16(), text.size());
+		if (isPlain(_out.data()+start, _out.size()-start)) return;
+		std::string utf8(_out, start);
+		_out.resize(start);
+		appendQuoted(utf8);
+	}
+
+	/// Mirrors yaml-cpp IsValidPlainScalar for block context
+	static bool isPlain(const char * text, std::size_t size) {
+		if (size == 0) return false;
+		std::string scalar(text, size);
+		if (scalar == "~" or scalar == "null" or scalar == "Null" or scalar == "NULL") return false;
+		auto at = [&](std::size_t i) -> int {
+			return i < size? (unsigned char)(text[i]) : -1;
+		};
+		auto endsToken = [&](std::size_t i) {
+			int c = at(i);
+			return c == -1 or c == ' ' or c == '\t' or c == '\n'
+				or (c == '\r' and at(i+1) == '\n');
+		};
+		if (endsToken(0)) return false;
+		if (std::memchr(",[]{}#&*!|>'\"%@`", at(0), 16)) return false;
+		if (std::memchr("-?:", at(0), 3) and endsToken(1)) return false;
+		if (text[size-1] == ' ') return false;
+		for (std::size_t i = 0; i < size; i++) {
+			int c = at(i);
+			if (c == ':' and endsToken(i+1)) return false;
+			if (c == ' ' and at(i+1) == '#') return false;
+			if (c < 0x20 and c != '\r') return false;
+			if (c == 0x7F) return false;
+			if (c == 0xC2 and at(i+1) >= 0x80 and at(i+1) <= 0x9F and at(i+1) != 0x85) return false;
+			if (c == 0xEF and at(i+1) == 0xBB and at(i+2) == 0xBF) return false;
+		}
+		return true;
+	}
+
+	/// Mirrors yaml-cpp WriteDoubleQuotedString
+	void appendQuoted(const std::string & utf8) {
+		static const char hexDigits[] = "0123456789abcdef";
+		_out += '"';
+		for (std::size_t i = 0; i < utf8.size(); ) {
+			unsigned char byte = utf8[i];
+			unsigned length = byte < 0x80? 1 : byte < 0xE0? 2 : byte < 0xF0? 3 : 4;
+			unsigned codePoint = length == 1? byte : byte & (0x7F >> length);
+			for (unsigned j = 1; j < length; j++) codePoint = codePoint << 6 | (utf8[i+j] & 0x3F);
+			switch (codePoint) {
+				case '"': _out.append("\\\""); break;
+				case '\\': _out.append("\\\\"); break;
+				case '\n': _out.append("\\n"); break;
+				case '\t': _out.append("\\t"); break;
+				case '\r': _out.append("\\r"); break;
+				case '\b': _out.append("\\b"); break;
+				default:
+					if (codePoint < 0x20 or (codePoint >= 0x80 and codePoint <= 0xA0) or codePoint == 0xFEFF) {
+						unsigned digits = codePoint < 0xFF? 2 : 4;
+						_out.append(digits == 2? "\\x" : "\\u");
+						while (digits--) _out += hexDigits[codePoint >> (4*digits) & 0xF];
+					}
+					else {
+						_out.append(utf8, i, length);
+					}
+			}
+			i += length;
+		}
+		_out += '"';
+	}
+
+	std::string & _out;
+	std::size_t _lineStart;
+	bool _inlineValue = false;
+	std::vector<Group> _groups;
+};
+
+// Set by --embed-files and --extract-files, which carry FileSelect contents
+static bool fileSelectsAttached = false;
+
+void dump(Poppler::FormFieldButton * field, YamlWriter & out) {
 	switch (field->buttonType()) {
 		case Poppler::FormFieldButton::CheckBox:
 		case Poppler::FormFieldButton::Radio:
-			out << bool(field->state());
+			out.value(bool(field->state()));
 			return;
 		case Poppler::FormFieldButton::Push:
-			out << YAML::Null;
+			out.null();
 			warn("Push button ignored '{}'",
 				field->fullyQualifiedName());
 	}
 }
-void dump(Poppler::FormFieldText * field, YAML::Emitter & out) {
+void dump(Poppler::FormFieldText * field, YamlWriter & out) {
 	switch (field->textType()) {
 		case Poppler::FormFieldText::FileSelect:
-			warn("File select not fully supported, managed as simple text, field {}",
-				field->fullyQualifiedName());
-			out << field->text();
+			if (not fileSelectsAttached)
+				warn("File select not fully supported, managed as simple text, field {}",
+					field->fullyQualifiedName());
+			out.value(field->text());
 			return;
 		case Poppler::FormFieldText::Multiline:
-			out << YAML::Literal << field->text() << YAML::Newline;
+			out.literal(field->text());
+			out.newline();
 			return;
 		case Poppler::FormFieldText::Normal:
-			out << field->text();
+			out.value(field->text());
 			return;
 	}
 }
 
-void dump(Poppler::FormFieldChoice * field, YAML::Emitter & out) {
+void dump(Poppler::FormFieldChoice * field, YamlWriter & out) {
+	// Translated once, not for every field
+	static const QString suggested = translate("Suggested values: %1");
+	static const QString allowed = translate("Allowed values: %1");
 	auto choices = field->choices();
 	auto currentChoices = field->currentChoices();
-	out << YAML::Newline;
-	out << YAML::Comment((field->isEditable()?
-			translate("Suggested values: %1"):
-			translate("Allowed values: %1"))
-		.arg(choices.join(QStringLiteral(", ")))
-		.toStdString()
-		);
+	out.newline();
+	out.comment((field->isEditable()? suggested : allowed)
+		.arg(choices.join(QStringLiteral(", "))));
 	if (field->multiSelect()) {
-		out << YAML::BeginSeq;
+		out.beginSeq();
 		for (auto i: currentChoices) {
-			out << choices[i];
+			out.value(choices[i]);
 		}
-		out << YAML::EndSeq;
+		out.endSeq();
 	}
 	else if (field->isEditable() and not field->editChoice().isNull()) {
-		out << field->editChoice();
+		out.value(field->editChoice());
 	}
 	else {
-		out << (currentChoices.empty()?"":choices[currentChoices.first()]);
+		out.value(currentChoices.empty()? QString() : choices[currentChoices.first()]);
 	}
 }
 
-void dump(Poppler::FormFieldSignature * field, YAML::Emitter & out) {
+void dump(Poppler::FormFieldSignature * field, YamlWriter & out) {
 	auto info = field->validate(
 		Poppler::FormFieldSignature::ValidateVerifyCertificate);
-	out << YAML::BeginMap;
-	out
-		<< "status" << info.signatureStatus()
-		<< "signer" << info.signerName()
-		<< "time" << QDateTime::fromMSecsSinceEpoch(
-				info.signingTime(), Qt::UTC)
-			.toString(Qt::ISODate)
-		<< "location" << info.location()
-		<< "reason" << info.reason()
-		<< "scope" << (info.signsTotalDocument()?"Total":"Partial")
-	;
-	out << YAML::EndMap;
+	out.beginMap();
+	// As YAML::Emitter did, the status is written as a number
+	out.key("status");
+	out.value(int(info.signatureStatus()));
+	out.key("signer");
+	out.value(info.signerName());
+	out.key("time");
+	out.value(QDateTime::fromMSecsSinceEpoch(
+			info.signingTime(), Qt::UTC)
+		.toString(Qt::ISODate));
+	out.key("location");
+	out.value(info.location());
+	out.key("reason");
+	out.value(info.reason());
+	out.key("scope");
+	out.value(info.signsTotalDocument()?"Total":"Partial");
+	out.endMap();
+}
+
+
+/// Description of a fillable field, enough to check a value
+/// for it without having the PDF loaded.
+struct FieldSpec {
+	std::string type;
+	bool readOnly = false;
+	bool editable = false;
+	bool multiSelect = false;
+	std::vector<std::string> choices;
+};
+
+FieldSpec fieldSpec(Poppler::FormField * field) {
+	FieldSpec spec;
+	spec.readOnly = field->isReadOnly();
+	switch (field->type()) {
+		case Poppler::FormField::FormButton:
+			switch (dynamic_cast<Poppler::FormFieldButton*>(field)->buttonType()) {
+				case Poppler::FormFieldButton::Push: spec.type = "push"; break;
+				case Poppler::FormFieldButton::CheckBox: spec.type = "checkbox"; break;
+				case Poppler::FormFieldButton::Radio: spec.type = "radio"; break;
+			}
+			break;
+		case Poppler::FormField::FormText:
+			switch (dynamic_cast<Poppler::FormFieldText*>(field)->textType()) {
+				case Poppler::FormFieldText::Normal: spec.type = "text"; break;
+				case Poppler::FormFieldText::Multiline: spec.type = "multiline"; break;
+				case Poppler::FormFieldText::FileSelect: spec.type = "fileselect"; break;
+			}
+			break;
+		case Poppler::FormField::FormChoice: {
+			auto choice = dynamic_cast<Poppler::FormFieldChoice*>(field);
+			spec.type = "choice";
+			spec.editable = choice->isEditable();
+			spec.multiSelect = choice->multiSelect();
+			for (auto value : choice->choices()) {
+				spec.choices.push_back(value.toStdString());
+			}
+			break;
+		}
+		case Poppler::FormField::FormSignature:
+			spec.type = "signature";
+			break;
+	}
+	return spec;
+}
+
+/// Flat index of the form fields by their data path,
+/// to validate records without opening the PDF.
+class FormSchema {
+public:
+	void add(const std::string & path, const FieldSpec & spec) {
+		_fields[path] = spec;
+		for (auto dot = path.find('.'); dot != std::string::npos; dot = path.find('.', dot+1)) {
+			_levels.insert(path.substr(0, dot));
+		}
+	}
+
+	void emit(YAML::Emitter & out) const {
+		out << YAML::BeginMap;
+		for (auto & entry : _fields) {
+			const FieldSpec & spec = entry.second;
+			out << YAML::Key << entry.first << YAML::Value << YAML::BeginMap;
+			out << "type" << spec.type;
+			if (spec.readOnly) out << "readonly" << true;
+			if (spec.type == "radiogroup") {
+				out << "choices" << YAML::Flow << spec.choices;
+			}
+			if (spec.type == "choice") {
+				out << "editable" << spec.editable;
+				out << "multiselect" << spec.multiSelect;
+				out << "choices" << YAML::Flow << spec.choices;
+			}
+			out << YAML::EndMap;
+		}
+		out << YAML::EndMap;
+	}
+
+	void load(const YAML::Node & node) {
+		if (not node.IsMap()) {
+			fail("Bad schema, a map of field paths expected");
+		}
+		for (auto entry : node) {
+			const YAML::Node & description = entry.second;
+			FieldSpec spec;
+			spec.type = description["type"].as<std::string>("");
+			spec.readOnly = description["readonly"].as<bool>(false);
+			spec.editable = description["editable"].as<bool>(false);
+			spec.multiSelect = description["multiselect"].as<bool>(false);
+			if (description["choices"]) {
+				spec.choices = description["choices"].as<std::vector<std::string>>();
+			}
+			add(entry.first.as<std::string>(), spec);
+		}
+	}
+
+	/// Checks a record the same way FieldTree::fill would,
+	/// appending a message for each problem found.
+	/// Returns true if the record has no problems.
+	bool validate(const YAML::Node & record, std::vector<std::string> & problems) const {
+		auto previous = problems.size();
+		validateLevel(record, "", problems);
+		return problems.size() == previous;
+	}
+
+private:
+	void validateLevel(const YAML::Node & node, const std::string & prefix, std::vector<std::string> & problems) const {
+		if (node.IsNull()) return;
+		if (not node.IsMap()) {
+			problems.push_back(fmt::format("Map required for '{}'",
+				prefix.empty()?"<root>":prefix));
+			return;
+		}
+		for (auto entry : node) {
+			std::string key = entry.first.as<std::string>();
+			std::string path = prefix.empty()? key : prefix+"."+key;
+			auto field = _fields.find(path);
+			if (field != _fields.end()) {
+				validateField(path, field->second, entry.second, problems);
+				continue;
+			}
+			if (_levels.count(path)) {
+				validateLevel(entry.second, path, problems);
+				continue;
+			}
+			problems.push_back(fmt::format("Unknown field '{}'", path));
+		}
+	}
+
+	void validateField(const std::string & path, const FieldSpec & spec, const YAML::Node & node, std::vector<std::string> & problems) const {
+		if (spec.type == "push") return;
+		if (spec.type == "text" or spec.type == "multiline" or spec.type == "fileselect") {
+			if (not node.IsScalar())
+				problems.push_back(fmt::format("String required for field '{}'", path));
+			return;
+		}
+		if (spec.type == "checkbox" or spec.type == "radio") {
+			bool value;
+			if (not node.IsScalar() or not YAML::convert<bool>::decode(node, value))
+				problems.push_back(fmt::format("Boolean value required for field '{}'", path));
+			return;
+		}
+		if (spec.type == "radiogroup") {
+			if (node.IsNull()) return;
+			if (not node.IsScalar()) {
+				problems.push_back(fmt::format("Scalar value required for field '{}'", path));
+				return;
+			}
+			std::string value = node.as<std::string>();
+			if (value.empty()) return;
+			validateChoice(path, spec, value, problems);
+			return;
+		}
+		if (spec.type == "choice") {
+			if (spec.multiSelect) {
+				if (not node.IsSequence()) {
+					problems.push_back(fmt::format("Sequence required for field '{}'", path));
+					return;
+				}
+				for (auto subnode : node) {
+					if (not subnode.IsScalar()) {
+						problems.push_back(fmt::format("Sequence of scalars values required for field '{}'", path));
+						return;
+					}
+					validateChoice(path, spec, subnode.as<std::string>(), problems);
+				}
+				return;
+			}
+			if (not node.IsScalar()) {
+				problems.push_back(fmt::format("Scalar value required for field '{}'", path));
+				return;
+			}
+			if (spec.editable) return;
+			validateChoice(path, spec, node.as<std::string>(), problems);
+			return;
+		}
+		problems.push_back(fmt::format("Unsupported field {} of type '{}'", path, spec.type));
+	}
+
+	void validateChoice(const std::string & path, const FieldSpec & spec, const std::string & value, std::vector<std::string> & problems) const {
+		for (auto & choice : spec.choices) {
+			if (choice == value) return;
+		}
+		std::string allowed;
+		for (auto & choice : spec.choices) {
+			if (not allowed.empty()) allowed += ", ";
+			allowed += choice;
+		}
+		problems.push_back(fmt::format("Illegal value '{}' for field '{}' try with {}",
+			value, path, allowed));
+	}
+
+	std::map<std::string, FieldSpec> _fields;
+	std::set<std::string> _levels;
+};
+
+/// Splits a multi-document YAML stream into records
+/// without loading the whole stream in memory.
+class RecordReader {
+public:
+	RecordReader(std::istream & input) : _input(input) {}
+
+	bool next(YAML::Node & record) {
+		std::string text = _pending;
+		bool hasContent = hasYamlContent(_pending);
+		_pending.clear();
+		std::string line;
+		while (std::getline(_input, line)) {
+			if (isMarker(line, "---")) {
+				if (hasContent) {
+					_pending = line.substr(3) + "\n";
+					break;
+				}
+				text = line.substr(3) + "\n";
+				hasContent = hasYamlContent(text);
+				continue;
+			}
+			// Ends the document, the next may start without '---'
+			if (isMarker(line, "...")) {
+				if (hasContent) break;
+				continue;
+			}
+			if (line.compare(0, 1, "%") == 0) continue;
+			text += line + "\n";
+			hasContent = hasContent or hasYamlContent(line);
+		}
+		if (not hasContent) return false;
+		_index++;
+		record = YAML::Load(text);
+		return true;
+	}
+
+	unsigned index() const { return _index; }
+
+private:
+	/// Document markers must be followed by a space or the line end,
+	/// '----' or '---x: 1' are content
+	static bool isMarker(const std::string & line, const char * marker) {
+		return line.compare(0, 3, marker) == 0
+			and (line.size() == 3 or std::isspace((unsigned char)line[3]));
+	}
+
+	static bool hasYamlContent(const std::string & text) {
+		for (auto c : text) {
+			if (c == '#') return false;
+			if (not std::isspace((unsigned char)c)) return true;
+		}
+		return false;
+	}
+
+	std::istream & _input;
+	std::string _pending;
+	unsigned _index = 0;
+};
+
+/// Radio buttons sharing a field, handled as a single value,
+/// the caption of the button which is on.
+struct RadioGroup {
+	QList<Poppler::FormFieldButton*> buttons;
+	QStringList captions;
+	QHash<QString, int> indexes;
+	int selected = -1;
+
+	bool add(Poppler::FormFieldButton * button) {
+		auto caption = button->caption();
+		if (indexes.contains(caption)) return false;
+		indexes[caption] = buttons.size();
+		if (button->state()) selected = buttons.size();
+		buttons.append(button);
+		captions.append(caption);
+		return true;
+	}
+
+	/// Switches on the indexed button, -1 for none.
+	/// Just the buttons going off and on are touched.
+	void select(int index) {
+		if (index == selected) return;
+		if (selected != -1) buttons[selected]->setState(false);
+		if (index != -1) buttons[index]->setState(true);
+		selected = index;
+	}
+};
+
+/// Radio group membership of the buttons being discovered,
+/// worked out once per group instead of once per button.
+class RadioGroups {
+public:
+	RadioGroups(bool merge=false) : _merge(merge) {}
+
+	/// Whether each group is to be a single field instead of a level
+	bool merge() const { return _merge; }
+
+	/// Returns the group the button belongs to or null if it has no siblings
+	std::shared_ptr<RadioGroup> groupOf(Poppler::FormFieldButton * button) {
+		auto known = _byId.find(button->id());
+		if (known != _byId.end()) return known->second;
+		auto siblings = button->siblings();
+		if (siblings.empty()) return nullptr;
+		auto group = std::make_shared<RadioGroup>();
+		_byId[button->id()] = group;
+		for (auto id : siblings) _byId[id] = group;
+		return group;
+	}
+
+private:
+	bool _merge;
+	std::map<int, std::shared_ptr<RadioGroup>> _byId;
+};
+
+/// Journal of the original values of the fields modified by a fill,
+/// so a template can be reset by undoing just what the record changed.
+class FormSnapshot {
+public:
+	/// Registers a field so it can be found as a radio sibling
+	void track(Poppler::FormField * field) {
+		_byId[field->id()] = field;
+	}
+
+	/// Saves the field value unless already saved since the last restore.
+	/// Call it before modifying the field.
+	void remember(Poppler::FormField * field) {
+		if (not _remembered.insert(field).second) return;
+		Saved saved;
+		saved.field = field;
+		switch (field->type()) {
+			case Poppler::FormField::FormButton: {
+				auto button = dynamic_cast<Poppler::FormFieldButton*>(field);
+				saved.state = button->state();
+				if (button->buttonType() != Poppler::FormFieldButton::Radio) break;
+				// Setting a radio button switches its siblings
+				for (auto id : button->siblings()) {
+					auto sibling = _byId.find(id);
+					if (sibling != _byId.end()) remember(sibling->second);
+				}
+				break;
+			}
+			case Poppler::FormField::FormText:
+				saved.text = dynamic_cast<Poppler::FormFieldText*>(field)->text();
+				break;
+			case Poppler::FormField::FormChoice: {
+				auto choice = dynamic_cast<Poppler::FormFieldChoice*>(field);
+				saved.choices = choice->currentChoices();
+				if (choice->isEditable()) saved.text = choice->editChoice();
+				break;
+			}
+			case Poppler::FormField::FormSignature:
+				break;
+		}
+		_saved.push_back(saved);
+	}
+
+	/// Saves the group selection unless already saved since the last restore
+	void remember(RadioGroup * group) {
+		if (not _rememberedGroups.insert(group).second) return;
+		Saved saved;
+		saved.field = nullptr;
+		saved.group = group;
+		saved.selected = group->selected;
+		_saved.push_back(saved);
+	}
+
+	/// Brings back the remembered values and forgets them.
+	/// Returns the number of fields restored.
+	unsigned restore() {
+		// Buttons that were on go last, so no sibling switches them off
+		for (auto & saved : _saved) {
+			if (isOnButton(saved)) continue;
+			apply(saved);
+		}
+		for (auto & saved : _saved) {
+			if (not isOnButton(saved)) continue;
+			apply(saved);
+		}
+		unsigned restored = _saved.size();
+		_saved.clear();
+		_remembered.clear();
+		_rememberedGroups.clear();
+		return restored;
+	}
+
+private:
+	struct Saved {
+		Poppler::FormField * field;
+		bool state = false;
+		QString text;
+		QList<int> choices;
+		RadioGroup * group = nullptr;
+		int selected = -1;
+	};
+
+	static bool isOnButton(const Saved & saved) {
+		if (not saved.field) return false;
+		return saved.field->type() == Poppler::FormField::FormButton and saved.state;
+	}
+
+	static void apply(const Saved & saved) {
+		if (saved.group) {
+			saved.group->select(saved.selected);
+			return;
+		}
+		switch (saved.field->type()) {
+			case Poppler::FormField::FormButton:
+				dynamic_cast<Poppler::FormFieldButton*>(saved.field)->setState(saved.state);
+				return;
+			case Poppler::FormField::FormText:
+				dynamic_cast<Poppler::FormFieldText*>(saved.field)->setText(saved.text);
+				return;
+			case Poppler::FormField::FormChoice: {
+				auto choice = dynamic_cast<Poppler::FormFieldChoice*>(saved.field);
+				choice->setCurrentChoices(saved.choices);
+				if (not saved.text.isNull()) choice->setEditChoice(saved.text);
+				return;
+			}
+			case Poppler::FormField::FormSignature:
+				return;
+		}
+	}
+
+	std::map<int, Poppler::FormField*> _byId;
+	std::set<Poppler::FormField*> _remembered;
+	std::set<RadioGroup*> _rememberedGroups;
+	std::vector<Saved> _saved;
+};
+
+
+/// Field value as a single line of text, for tables
+std::string valueText(Poppler::FormField * field) {
+	switch (field->type()) {
+		case Poppler::FormField::FormButton: {
+			auto button = dynamic_cast<Poppler::FormFieldButton*>(field);
+			if (button->buttonType() == Poppler::FormFieldButton::Push) return "";
+			return button->state()? "true" : "false";
+		}
+		case Poppler::FormField::FormText:
+			return dynamic_cast<Poppler::FormFieldText*>(field)->text().toStdString();
+		case Poppler::FormField::FormChoice: {
+			auto choice = dynamic_cast<Poppler::FormFieldChoice*>(field);
+			auto choices = choice->choices();
+			if (choice->multiSelect()) {
+				QStringList selected;
+				for (auto i : choice->currentChoices()) selected.append(choices[i]);
+				return selected.join("; ").toStdString();
+			}
+			if (choice->isEditable() and not choice->editChoice().isNull())
+				return choice->editChoice().toStdString();
+			auto current = choice->currentChoices();
+			return current.empty()? "" : choices[current.first()].toStdString();
+		}
+		case Poppler::FormField::FormSignature: {
+			auto info = dynamic_cast<Poppler::FormFieldSignature*>(field)->validate(
+				Poppler::FormFieldSignature::ValidateVerifyCertificate);
+			std::ostringstream status;
+			status << info.signatureStatus();
+			return status.str();
+		}
+	}
+	return "";
 }
 
+/// A record value not matching the one in the PDF
+struct Difference {
+	std::string field;
+	std::string expected;
+	std::string actual;
+	std::string problem;
+};
+
+/// A file referred by a FileSelect field
+struct Attachment {
+	std::string field;
+	std::string path;
+};
+
 
 class FieldTree {
 public:
@@ -189,7 +971,7 @@ public:
 		}
 		_children[name] = FieldTree(field);
 	}
-	void _addLeaf(const QString & name, Poppler::FormField * field) {
+	void _addLeaf(const QString & name, Poppler::FormField * field, RadioGroups & groups) {
 
 		//step("addLeaf '{}' '{}'", name, field? field->name():"None");
 		auto button = dynamic_cast<Poppler::FormFieldButton*>(field);
@@ -197,26 +979,35 @@ public:
 			_addTerminal(name, field);
 			return;
 		}
-		if (not button->siblings().length()) {
+		auto group = groups.groupOf(button);
+		if (not group) {
 			_addTerminal(name, field);
 			return;
 		}
 		FieldTree & intermediate = _addLevel(name);
-		intermediate._addTerminal(button->caption(), field);
+		if (not groups.merge()) {
+			intermediate._addTerminal(button->caption(), field);
+			return;
+		}
+		intermediate._group = group;
+		if (not group->add(button)) {
+			warn("Overwriting existing field '{}', '{}'",
+				field->fullyQualifiedName(), button->caption());
+		}
 	}
 
-	void add(const QString & fullName, Poppler::FormField * field) {
+	void add(const QString & fullName, Poppler::FormField * field, RadioGroups & groups) {
 		//step("creating '{}' '{}'", fullName, field? field->name():"None");
 		int dotPos = fullName.indexOf('.');
 		if (dotPos == -1) {
-			_addLeaf(fullName, field);
+			_addLeaf(fullName, field, groups);
 			return;
 		}
 		QString levelName = fullName.left(dotPos);
 		FieldTree & level = _addLevel(levelName);
 
 		QString remaining = fullName.mid(dotPos+1);
-		level.add(remaining, field);
+		level.add(remaining, field, groups);
 	}
 
 	void debugTree(const std::string & prefix="") {
@@ -227,60 +1018,262 @@ public:
 		}
 	}
 
-	void extract(YAML::Emitter & out) {
-		if (_field) extractField(out);
-		else extractChildren(out);
+	void schema(FormSchema & schema, const QString & prefix="") {
+		if (_field) {
+			schema.add(prefix.toStdString(), fieldSpec(_field));
+			return;
+		}
+		if (_group) {
+			FieldSpec spec;
+			spec.type = "radiogroup";
+			spec.readOnly = _group->buttons.first()->isReadOnly();
+			for (auto caption : _group->captions) {
+				spec.choices.push_back(caption.toStdString());
+			}
+			schema.add(prefix.toStdString(), spec);
+			return;
+		}
+		for (auto key : _children.keys()) {
+			_children[key].schema(schema,
+				prefix.isEmpty()? key : prefix+"."+key);
+		}
 	}
 
-	void extractChildren(YAML::Emitter & out) {
-		out << YAML::BeginMap;
+	/// Collects the files referred by the FileSelect fields
+	void fileSelections(std::vector<Attachment> & attachments) {
+		if (_group) return;
+		if (_field) {
+			auto text = dynamic_cast<Poppler::FormFieldText*>(_field);
+			if (not text) return;
+			if (text->textType() != Poppler::FormFieldText::FileSelect) return;
+			if (text->text().isEmpty()) return;
+			attachments.push_back({
+				text->fullyQualifiedName().toStdString(),
+				text->text().toStdString()});
+			return;
+		}
 		for (auto key : _children.keys()) {
-			out << key;
-			_children[key].extract(out);
+			_children[key].fileSelections(attachments);
 		}
-		out << YAML::EndMap;
 	}
 
-	void extractField(YAML::Emitter & out) {
-		QString comment = translate("%1%2")
-			.arg(_field->name()!=_field->uiName()?_field->uiName():QString())
-			.arg(_field->isReadOnly()?" [Read Only]":"")
-			;
-		if (!comment.isEmpty())
-			out << YAML::Comment(comment.toStdString());
-		switch (_field->type()) {
-			case Poppler::FormField::FormButton:
-				dump(dynamic_cast<Poppler::FormFieldButton*>(_field), out);
-				break;
-			case Poppler::FormField::FormText:
-				dump(dynamic_cast<Poppler::FormFieldText*>(_field), out);
-				break;
-			case Poppler::FormField::FormChoice:
-				dump(dynamic_cast<Poppler::FormFieldChoice*>(_field), out);
-				break;
-			case Poppler::FormField::FormSignature:
-				dump(dynamic_cast<Poppler::FormFieldSignature*>(_field), out);
-				break;
+	/// Collects the value of each field as text, by path
+	void flatten(std::map<std::string, std::string> & values, const QString & prefix="") {
+		if (_field) {
+			values[prefix.toStdString()] = valueText(_field);
+			return;
+		}
+		if (_group) {
+			values[prefix.toStdString()] = _group->selected==-1? "" :
+				_group->captions[_group->selected].toStdString();
+			return;
+		}
+		for (auto key : _children.keys()) {
+			_children[key].flatten(values,
+				prefix.isEmpty()? key : prefix+"."+key);
 		}
 	}
 
-
-	void fill(Poppler::FormField * field, const YAML::Node & node) {
-		error("Unsupported field {} of type '{}'",
-			field->fullyQualifiedName(),
-			field->type());
+	/// Compares the values in node with the ones in the fields,
+	/// appending the mismatches to differences. Missing keys
+	/// are not compared, as fill leaves those fields untouched.
+	/// Returns false when stopped at the first difference.
+	bool verify(const YAML::Node & node, std::vector<Difference> & differences, bool firstOnly, const std::string & prefix="") {
+		if (_field) verifyField(node, differences, prefix);
+		else if (_group) verifyGroup(node, differences, prefix);
+		else return verifyChildren(node, differences, firstOnly, prefix);
+		return not (firstOnly and not differences.empty());
 	}
 
-	void fill(Poppler::FormFieldText * field, const YAML::Node & node) {
-		if (not node.IsScalar()) {
-			error("String required for field '{}'",
-				field->fullyQualifiedName());
+	bool verifyChildren(const YAML::Node & node, std::vector<Difference> & differences, bool firstOnly, const std::string & prefix) {
+		if (node.IsNull()) return true;
+		if (not node.IsMap()) {
+			differences.push_back({prefix, "", "", fmt::format(
+				"Map required for '{}'", prefix.empty()?"<root>":prefix)});
+			return not firstOnly;
 		}
-		field->setText(node.as<std::string>().c_str());
+		for (auto entry : node) {
+			std::string key = entry.first.as<std::string>();
+			std::string path = prefix.empty()? key : prefix+"."+key;
+			auto child = _children.find(QString::fromStdString(key));
+			if (child == _children.end()) {
+				differences.push_back({path, "", "", "Unknown field"});
+				if (firstOnly) return false;
+				continue;
+			}
+			if (not child->verify(entry.second, differences, firstOnly, path)) return false;
+		}
+		return true;
 	}
 
-	void fill(Poppler::FormFieldButton * field, const YAML::Node & node) {
-		switch (field->buttonType()) {
+	void verifyGroup(const YAML::Node & node, std::vector<Difference> & differences, const std::string & path) {
+		if (not node.IsNull() and not node.IsScalar()) {
+			differences.push_back({path, "", "", fmt::format(
+				"Scalar value required for field '{}'", path)});
+			return;
+		}
+		std::string expected = node.IsNull()? "" : node.as<std::string>();
+		std::string actual = _group->selected==-1? "" :
+			_group->captions[_group->selected].toStdString();
+		if (not expected.empty() and not _group->indexes.contains(QString::fromStdString(expected))) {
+			differences.push_back({path, "", actual, fmt::format(
+				"Illegal value '{}' for field '{}' try with {}",
+				expected, path, _group->captions.join(", "))});
+			return;
+		}
+		if (expected != actual) differences.push_back({path, expected, actual, ""});
+	}
+
+	void verifyField(const YAML::Node & node, std::vector<Difference> & differences, const std::string & path) {
+		std::string expected;
+		std::string actual = valueText(_field);
+		switch (_field->type()) {
+			case Poppler::FormField::FormSignature:
+				return;
+			case Poppler::FormField::FormButton: {
+				auto button = dynamic_cast<Poppler::FormFieldButton*>(_field);
+				if (button->buttonType() == Poppler::FormFieldButton::Push) return;
+				bool value;
+				if (not node.IsScalar() or not YAML::convert<bool>::decode(node, value)) {
+					differences.push_back({path, "", actual, fmt::format(
+						"Boolean value required for field '{}'", path)});
+					return;
+				}
+				expected = value? "true" : "false";
+				break;
+			}
+			case Poppler::FormField::FormText:
+				if (not node.IsScalar()) {
+					differences.push_back({path, "", actual, fmt::format(
+						"String required for field '{}'", path)});
+					return;
+				}
+				expected = node.as<std::string>();
+				// Literal blocks bring trailing newlines the field has not
+				if (dynamic_cast<Poppler::FormFieldText*>(_field)->textType()
+						== Poppler::FormFieldText::Multiline) {
+					while (not expected.empty() and expected.back()=='\n') expected.pop_back();
+					while (not actual.empty() and actual.back()=='\n') actual.pop_back();
+				}
+				break;
+			case Poppler::FormField::FormChoice: {
+				auto choice = dynamic_cast<Poppler::FormFieldChoice*>(_field);
+				if (not choice->multiSelect()) {
+					if (not node.IsScalar()) {
+						differences.push_back({path, "", actual, fmt::format(
+							"Scalar value required for field '{}'", path)});
+						return;
+					}
+					expected = node.as<std::string>();
+					// Editable choices take any value as fill does
+					auto choices = choice->choices();
+					if (not choice->isEditable() and choices.indexOf(expected.c_str()) == -1) {
+						differences.push_back({path, "", actual, fmt::format(
+							"Illegal value '{}' for field '{}' try with {}",
+							expected, path, choices.join(", "))});
+						return;
+					}
+					break;
+				}
+				if (not node.IsSequence()) {
+					differences.push_back({path, "", actual, fmt::format(
+						"Sequence required for field '{}'", path)});
+					return;
+				}
+				// Poppler keeps the selection in choice order
+				auto choices = choice->choices();
+				std::set<int> selection;
+				for (auto subnode : node) {
+					if (not subnode.IsScalar()) {
+						differences.push_back({path, "", actual, fmt::format(
+							"Sequence of scalars values required for field '{}'", path)});
+						return;
+					}
+					std::string value = subnode.as<std::string>();
+					int selected = choices.indexOf(value.c_str());
+					if (selected == -1) {
+						differences.push_back({path, "", actual, fmt::format(
+							"Illegal value '{}' for field '{}' try with {}",
+							value, path, choices.join(", "))});
+						return;
+					}
+					selection.insert(selected);
+				}
+				QStringList selected;
+				for (auto i : selection) selected.append(choices[i]);
+				expected = selected.join("; ").toStdString();
+				break;
+			}
+		}
+		if (expected != actual) differences.push_back({path, expected, actual, ""});
+	}
+
+	void extract(YamlWriter & out) {
+		if (_field) extractField(out);
+		else if (_group) extractGroup(out);
+		else extractChildren(out);
+	}
+
+	void extractChildren(YamlWriter & out) {
+		out.beginMap();
+		for (auto child = _children.begin(); child != _children.end(); ++child) {
+			out.key(child.key());
+			child.value().extract(out);
+		}
+		out.endMap();
+	}
+
+	static void extractComment(YamlWriter & out, Poppler::FormField * field) {
+		QString comment = field->name()!=field->uiName()? field->uiName() : QString();
+		if (field->isReadOnly()) comment += QStringLiteral(" [Read Only]");
+		if (!comment.isEmpty())
+			out.comment(comment);
+	}
+
+	void extractGroup(YamlWriter & out) {
+		static const QString allowed = translate("Allowed values: %1");
+		extractComment(out, _group->buttons.first());
+		out.newline();
+		out.comment(allowed.arg(_group->captions.join(QStringLiteral(", "))));
+		out.value(_group->selected==-1?QString():_group->captions[_group->selected]);
+	}
+
+	void extractField(YamlWriter & out) {
+		extractComment(out, _field);
+		switch (_field->type()) {
+			case Poppler::FormField::FormButton:
+				dump(dynamic_cast<Poppler::FormFieldButton*>(_field), out);
+				break;
+			case Poppler::FormField::FormText:
+				dump(dynamic_cast<Poppler::FormFieldText*>(_field), out);
+				break;
+			case Poppler::FormField::FormChoice:
+				dump(dynamic_cast<Poppler::FormFieldChoice*>(_field), out);
+				break;
+			case Poppler::FormField::FormSignature:
+				dump(dynamic_cast<Poppler::FormFieldSignature*>(_field), out);
+				break;
+		}
+	}
+
+
+	void fill(Poppler::FormField * field, const YAML::Node & node, FormSnapshot * snapshot) {
+		error("Unsupported field {} of type '{}'",
+			field->fullyQualifiedName(),
+			field->type());
+	}
+
+	void fill(Poppler::FormFieldText * field, const YAML::Node & node, FormSnapshot * snapshot) {
+		if (not node.IsScalar()) {
+			error("String required for field '{}'",
+				field->fullyQualifiedName());
+		}
+		if (snapshot) snapshot->remember(field);
+		field->setText(node.as<std::string>().c_str());
+	}
+
+	void fill(Poppler::FormFieldButton * field, const YAML::Node & node, FormSnapshot * snapshot) {
+		switch (field->buttonType()) {
 			case Poppler::FormFieldButton::CheckBox:
 			case Poppler::FormFieldButton::Radio:
 			{
@@ -290,6 +1283,7 @@ public:
 					return;
 				}
 				bool value = node.as<bool>();
+				if (snapshot) snapshot->remember(field);
 				field->setState(value);
 				return;
 			}
@@ -298,7 +1292,7 @@ public:
 		}
 	}
 
-	void fill(Poppler::FormFieldChoice * field, const YAML::Node & node) {
+	void fill(Poppler::FormFieldChoice * field, const YAML::Node & node, FormSnapshot * snapshot) {
 		auto choices = field->choices();
 		if (field->multiSelect()) {
 			if (not node.IsSequence()) {
@@ -322,6 +1316,7 @@ public:
 				}
 				selection.append(selected);
 			}
+			if (snapshot) snapshot->remember(field);
 			field->setCurrentChoices(selection);
 			return;
 		}
@@ -333,6 +1328,7 @@ public:
 		std::string value = node.as<std::string>();
 
 		int selected = choices.indexOf(value.c_str());
+		if (snapshot) snapshot->remember(field);
 		if (selected==-1 and field->isEditable()) {
 			field->setEditChoice(value.c_str());
 			return;
@@ -348,53 +1344,1821 @@ public:
 		field->setCurrentChoices(selection);
 	}
 
-	void fillChildren(const YAML::Node & node) {
+	void fillChildren(const YAML::Node & node, FormSnapshot * snapshot) {
 		for (auto key : _children.keys()) {
 			const YAML::Node & subnode = node[key.toStdString()];
-			_children[key].fill(subnode);
+			if (not subnode.IsDefined()) continue; // Missing keys keep their value
+			_children[key].fill(subnode, snapshot);
 		}
 	}
-	void fillField(const YAML::Node & node) {
+	void fillField(const YAML::Node & node, FormSnapshot * snapshot) {
 		if (!_field) return;
 		switch (_field->type()) {
 			case Poppler::FormField::FormButton:
-				fill(dynamic_cast<Poppler::FormFieldButton*>(_field), node);
+				fill(dynamic_cast<Poppler::FormFieldButton*>(_field), node, snapshot);
 				break;
 			case Poppler::FormField::FormText:
-				fill(dynamic_cast<Poppler::FormFieldText*>(_field), node);
+				fill(dynamic_cast<Poppler::FormFieldText*>(_field), node, snapshot);
 				break;
 			case Poppler::FormField::FormChoice:
-				fill(dynamic_cast<Poppler::FormFieldChoice*>(_field), node);
+				fill(dynamic_cast<Poppler::FormFieldChoice*>(_field), node, snapshot);
 				break;
 			case Poppler::FormField::FormSignature:
-				fill(dynamic_cast<Poppler::FormFieldSignature*>(_field), node);
+				fill(dynamic_cast<Poppler::FormFieldSignature*>(_field), node, snapshot);
 				break;
 		}
 	}
-	void fill(const YAML::Node & node) {
-		if (_field) fillField(node);
-		else fillChildren(node);
+	/// Sets the field values in node.
+	/// If a snapshot is given, it remembers the previous values
+	/// of the modified fields so that they can be restored.
+	void fill(const YAML::Node & node, FormSnapshot * snapshot=nullptr) {
+		if (_field) fillField(node, snapshot);
+		else if (_group) fillGroup(node, snapshot);
+		else fillChildren(node, snapshot);
+	}
+
+	void fillGroup(const YAML::Node & node, FormSnapshot * snapshot) {
+		auto name = _group->buttons.first()->fullyQualifiedName();
+		if (not node.IsNull() and not node.IsScalar()) {
+			error("Scalar value required for field '{}'", name);
+			return;
+		}
+		int selected = -1;
+		QString value = node.IsNull()? QString() : node.as<std::string>().c_str();
+		if (not value.isEmpty()) {
+			auto found = _group->indexes.constFind(value);
+			if (found == _group->indexes.constEnd()) {
+				error("Illegal value '{}' for field '{}' try with {}",
+					value, name, _group->captions.join(", "));
+				return;
+			}
+			selected = found.value();
+		}
+		if (snapshot) snapshot->remember(_group.get());
+		_group->select(selected);
 	}
 private:
 	QMap<QString, FieldTree> _children;
 	Poppler::FormField * _field;
+	std::shared_ptr<RadioGroup> _group;
+};
+
+/// A loaded PDF with its discovered field tree.
+/// Owns the poppler pages and fields the tree refers to.
+class FormDocument {
+public:
+	bool load(const QString & filename) {
+		_filename = filename;
+		_document.reset(Poppler::Document::load(filename));
+		return bool(_document);
+	}
+	bool load(const QByteArray & data) {
+		_data = data;
+		_document.reset(Poppler::Document::loadFromData(data));
+		return bool(_document);
+	}
+	/// Builds the field tree. With radioGroups, each group of radio
+	/// buttons becomes a single field instead of a level of booleans.
+	/// With several jobs, page ranges are scanned concurrently,
+	/// each thread on its own document handle. Fields then belong
+	/// to different handles and saving would miss changes to them,
+	/// so use it just for extraction.
+	void discover(bool radioGroups=false, unsigned jobs=1) {
+		unsigned nPages = _document->numPages();
+		std::vector<Poppler::Page*> pages(nPages, nullptr);
+		std::vector<QList<Poppler::FormField*>> fields(nPages);
+		auto scan = [&pages, &fields](Poppler::Document * document, unsigned begin, unsigned end) {
+			for (unsigned page=begin; page<end; page++) {
+				pages[page] = document->page(page);  // Document starts at page 0
+				if (pages[page]) fields[page] = pages[page]->formFields();
+			}
+		};
+		if (jobs > nPages) jobs = nPages;
+		if (jobs <= 1) {
+			scan(_document.get(), 0, nPages);
+		}
+		else {
+			// Each thread loads its own handle, so loads overlap too
+			size_t first = _handles.size();
+			_handles.resize(first + jobs - 1);
+			std::vector<std::thread> threads;
+			for (unsigned job=0; job<jobs; job++) {
+				threads.emplace_back([this, &scan, job, jobs, nPages, first] {
+					Poppler::Document * document = _document.get();
+					if (job) {
+						auto & handle = _handles[first + job - 1];
+						handle.reset(_filename.isEmpty()?
+							Poppler::Document::loadFromData(_data):
+							Poppler::Document::load(_filename));
+						document = handle.get();
+						if (not document) return;
+					}
+					scan(document, nPages*job/jobs, nPages*(job+1)/jobs);
+				});
+			}
+			for (auto & thread : threads) thread.join();
+			for (size_t i=first; i<_handles.size(); i++)
+				_handles[i] or fail("Unable to open the document");
+		}
+		// Merged in page order, as the serial scan would do
+		RadioGroups groups(radioGroups);
+		for (unsigned page=0; page<nPages; page++) {
+			if (not pages[page]) continue;
+			_pages.emplace_back(pages[page]);
+			for (auto field : fields[page]) {
+				_fields.emplace_back(field);
+				_snapshot.track(field);
+				_tree.add(field->fullyQualifiedName(), field, groups);
+			}
+		}
+	}
+	bool save(const QString & filename) {
+		auto converter = std::unique_ptr<Poppler::PDFConverter>(_document->pdfConverter());
+		converter->setOutputFileName(filename);
+		converter->setPDFOptions(Poppler::PDFConverter::WithChanges);
+		return converter->convert();
+	}
+	bool save(QIODevice * device) {
+		auto converter = std::unique_ptr<Poppler::PDFConverter>(_document->pdfConverter());
+		converter->setOutputDevice(device);
+		converter->setPDFOptions(Poppler::PDFConverter::WithChanges);
+		return converter->convert();
+	}
+	/// Fills the form keeping track of the changes, see restore()
+	void fill(const YAML::Node & node) {
+		_tree.fill(node, &_snapshot);
+	}
+	/// Undoes the changes done by fill() since the last restore.
+	/// Returns the number of fields restored.
+	unsigned restore() {
+		return _snapshot.restore();
+	}
+	Poppler::Document * document() { return _document.get(); }
+	FieldTree & fields() { return _tree; }
+private:
+	QString _filename;
+	QByteArray _data;
+	// Destroyed bottom up: tree, fields and pages before the documents
+	std::unique_ptr<Poppler::Document> _document;
+	std::vector<std::unique_ptr<Poppler::Document>> _handles;
+	std::vector<std::unique_ptr<Poppler::Page>> _pages;
+	std::vector<std::unique_ptr<Poppler::FormField>> _fields;
+	FieldTree _tree;
+	FormSnapshot _snapshot;
+};
+
+using Clock = std::chrono::steady_clock;
+
+static long milliseconds(Clock::duration duration) {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+}
+
+/// Queue between two pipeline stages. Producers block while it is full,
+/// so a slow stage throttles the ones feeding it.
+template <typename T>
+class BoundedQueue {
+public:
+	BoundedQueue(const std::string & name, unsigned capacity)
+		: _name(name), _capacity(capacity?capacity:1) {}
+
+	void push(T item) {
+		std::unique_lock<std::mutex> lock(_mutex);
+		auto start = Clock::now();
+		_notFull.wait(lock, [this]{ return _items.size() < _capacity; });
+		_producerStall += Clock::now() - start;
+		_items.push_back(std::move(item));
+		_transferred++;
+		if (_items.size() > _maxDepth) _maxDepth = _items.size();
+		_notEmpty.notify_one();
+	}
+
+	/// Returns false once the queue is closed and drained
+	bool pop(T & item) {
+		std::unique_lock<std::mutex> lock(_mutex);
+		auto start = Clock::now();
+		_notEmpty.wait(lock, [this]{ return _closed or not _items.empty(); });
+		_consumerStall += Clock::now() - start;
+		if (_items.empty()) return false;
+		item = std::move(_items.front());
+		_items.pop_front();
+		_notFull.notify_one();
+		return true;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_closed = true;
+		_notEmpty.notify_all();
+	}
+
+	void report(YAML::Emitter & out) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		out << YAML::Key << _name << YAML::Value << YAML::BeginMap;
+		out << "capacity" << _capacity;
+		out << "transferred" << _transferred;
+		out << "max_depth" << _maxDepth;
+		out << "producer_stall_ms" << milliseconds(_producerStall);
+		out << "consumer_stall_ms" << milliseconds(_consumerStall);
+		out << YAML::EndMap;
+	}
+
+private:
+	std::string _name;
+	size_t _capacity;
+	std::deque<T> _items;
+	std::mutex _mutex;
+	std::condition_variable _notEmpty;
+	std::condition_variable _notFull;
+	bool _closed = false;
+	unsigned _transferred = 0;
+	size_t _maxDepth = 0;
+	Clock::duration _producerStall = Clock::duration::zero();
+	Clock::duration _consumerStall = Clock::duration::zero();
+};
+
+/// Outcome of a document processed by DocumentBudget::run
+struct DocumentOutcome {
+	bool ok = false;
+	std::string phase;
+	std::string error;
+	std::string output;
+};
+
+/// Lets the work on a document tell its phase and hand its output,
+/// either in place or from the child process running it.
+class DocumentTask {
+public:
+	DocumentTask(DocumentOutcome & outcome) : _outcome(&outcome) {}
+	DocumentTask(int channel) : _channel(channel) {}
+
+	void phase(const char * name) {
+		if (_outcome) _outcome->phase = name;
+		else send('P', name, std::strlen(name));
+	}
+	void output(const char * data, size_t size) {
+		if (_outcome) _outcome->output.assign(data, size);
+		else send('O', data, size);
+	}
+	void output(const std::string & data) { output(data.data(), data.size()); }
+	void failure(const std::string & message) {
+		if (_outcome) _outcome->error = message;
+		else send('E', message.data(), message.size());
+	}
+
+private:
+	/// Frames are the type, the size and the data
+	void send(char type, const char * data, uint32_t size) {
+		char header[5] = {type};
+		std::memcpy(header+1, &size, 4);
+		sendAll(header, 5);
+		sendAll(data, size);
+	}
+	void sendAll(const char * data, size_t size) {
+		while (size) {
+			ssize_t sent = write(_channel, data, size);
+			if (sent < 0 and errno == EINTR) continue;
+			if (sent <= 0) _exit(1);
+			data += sent;
+			size -= sent;
+		}
+	}
+
+	DocumentOutcome * _outcome = nullptr;
+	int _channel = -1;
+};
+
+/// Time and memory limits for each document of batch, aggregate and
+/// watch runs, and the latency histogram of the documents.
+/// With limits, each document is processed in a forked child.
+/// The child is killed when over time, and its address space is
+/// limited, so a pathological document just fails, reporting
+/// the phase it was in, and the next one gets a fresh process.
+/// Without limits, documents are processed in place.
+class DocumentBudget {
+public:
+	DocumentBudget(unsigned timeLimitMs, unsigned memoryLimitMb)
+		: _timeLimitMs(timeLimitMs)
+		, _memoryLimitMb(memoryLimitMb)
+		, _histogram(sizeof(_bounds)/sizeof(_bounds[0])+1)
+	{
+		// Children must not inherit the log locked by another thread
+		static std::once_flag once;
+		std::call_once(once, []{
+			pthread_atfork(lockLog, unlockLog, unlockLog);
+		});
+	}
+
+	bool limited() const { return _timeLimitMs or _memoryLimitMb; }
+
+	template <typename Work>
+	DocumentOutcome run(Work work) {
+		auto start = Clock::now();
+		DocumentOutcome outcome = limited()?
+			isolated(std::function<void(DocumentTask&)>(work)) :
+			inPlace(work);
+		record(Clock::now() - start);
+		return outcome;
+	}
+
+	template <typename Work>
+	static DocumentOutcome inPlace(Work work) {
+		DocumentOutcome outcome;
+		DocumentTask task(outcome);
+		try {
+			work(task);
+			outcome.ok = true;
+		}
+		catch (std::exception & e) {
+			task.failure(e.what());
+		}
+		return outcome;
+	}
+
+	void record(Clock::duration latency) {
+		long ms = milliseconds(latency);
+		unsigned bucket = 0;
+		while (bucket < _histogram.size()-1 and ms > _bounds[bucket]) bucket++;
+		std::lock_guard<std::mutex> lock(_mutex);
+		_histogram[bucket]++;
+	}
+
+	void report(YAML::Emitter & out) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		out << YAML::Key << "documents" << YAML::Value << YAML::BeginMap;
+		out << "time_limit_ms" << _timeLimitMs;
+		out << "memory_limit_mb" << _memoryLimitMb;
+		out << "over_time" << _overTime;
+		out << "over_memory" << _overMemory;
+		out << "crashed" << _crashed;
+		out << YAML::Key << "latency_histogram_ms" << YAML::Value << YAML::BeginMap;
+		for (unsigned i=0; i<_histogram.size(); i++) {
+			if (i < _histogram.size()-1) out << YAML::Key << _bounds[i];
+			else out << YAML::Key << "more";
+			out << YAML::Value << _histogram[i];
+		}
+		out << YAML::EndMap;
+		out << YAML::EndMap;
+	}
+
+private:
+	static const int overMemoryExit = 3;
+
+	DocumentOutcome isolated(const std::function<void(DocumentTask&)> & work) {
+		DocumentOutcome outcome;
+		// Children never exec, so they keep any pipe open at fork time.
+		// A child holding the write end of a sibling would delay its EOF
+		// until the child ends, so no pipe is created while forking.
+		static std::mutex forkMutex;
+		std::unique_lock<std::mutex> forking(forkMutex);
+		int channel[2];
+		if (pipe(channel)) {
+			outcome.error = "Unable to create a pipe for the worker";
+			return outcome;
+		}
+		pid_t child = fork();
+		if (child == -1) {
+			close(channel[0]);
+			close(channel[1]);
+			outcome.error = "Unable to start a worker process";
+			return outcome;
+		}
+		if (child == 0) {
+			close(channel[0]);
+			DocumentTask task(channel[1]);
+			if (_memoryLimitMb) {
+				rlimit limit;
+				limit.rlim_cur = limit.rlim_max = addressSpace() + (rlim_t(_memoryLimitMb) << 20);
+				setrlimit(RLIMIT_AS, &limit);
+			}
+			int status = 0;
+			try {
+				work(task);
+			}
+			catch (std::bad_alloc &) {
+				status = overMemoryExit;
+			}
+			catch (std::exception & e) {
+				task.failure(e.what());
+				status = 1;
+			}
+			// No exit handlers, they belong to the parent
+			_exit(status);
+		}
+		close(channel[1]);
+		forking.unlock();
+		bool overTime = not receive(channel[0], outcome);
+		close(channel[0]);
+		if (overTime) kill(child, SIGKILL);
+		int status = 0;
+		while (waitpid(child, &status, 0) == -1 and errno == EINTR);
+
+		std::string phase = outcome.phase.empty()? "start" : outcome.phase;
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (overTime) {
+			_overTime++;
+			outcome.error = fmt::format("Over the time limit of {} ms while in phase {}",
+				_timeLimitMs, phase);
+		}
+		else if (WIFEXITED(status) and WEXITSTATUS(status) == 0) {
+			outcome.ok = true;
+		}
+		else if (WIFEXITED(status) and WEXITSTATUS(status) == overMemoryExit) {
+			_overMemory++;
+			outcome.error = fmt::format("Over the memory limit of {} MB while in phase {}",
+				_memoryLimitMb, phase);
+		}
+		// Poppler aborts when it runs out of memory
+		else if (WIFSIGNALED(status) and WTERMSIG(status) == SIGABRT and _memoryLimitMb) {
+			_overMemory++;
+			outcome.error = fmt::format("Aborted, likely over the memory limit of {} MB, while in phase {}",
+				_memoryLimitMb, phase);
+		}
+		else if (WIFSIGNALED(status)) {
+			_crashed++;
+			outcome.error = fmt::format("Crashed with signal {} while in phase {}",
+				WTERMSIG(status), phase);
+		}
+		else if (outcome.error.empty()) {
+			outcome.error = fmt::format("Failed while in phase {}", phase);
+		}
+		return outcome;
+	}
+
+	/// Collects the frames sent by the child until it closes the pipe.
+	/// Returns false if the time limit is reached before.
+	bool receive(int channel, DocumentOutcome & outcome) {
+		auto deadline = Clock::now() + std::chrono::milliseconds(_timeLimitMs);
+		std::string received;
+		char buffer[64*1024];
+		while (true) {
+			int timeout = -1;
+			if (_timeLimitMs) {
+				long left = milliseconds(deadline - Clock::now());
+				if (left <= 0) break;
+				timeout = int(left);
+			}
+			pollfd input = {channel, POLLIN, 0};
+			int ready = poll(&input, 1, timeout);
+			if (ready < 0 and errno == EINTR) continue;
+			if (ready <= 0) break;
+			ssize_t length = read(channel, buffer, sizeof(buffer));
+			if (length < 0 and errno == EINTR) continue;
+			if (length <= 0) {
+				parseFrames(received, outcome);
+				return true;
+			}
+			received.append(buffer, length);
+		}
+		parseFrames(received, outcome);
+		return false;
+	}
+
+	static void parseFrames(const std::string & received, DocumentOutcome & outcome) {
+		for (size_t position = 0; position + 5 <= received.size(); ) {
+			char type = received[position];
+			uint32_t size;
+			std::memcpy(&size, received.data()+position+1, 4);
+			position += 5;
+			if (position + size > received.size()) return; // Cut by a kill
+			std::string data = received.substr(position, size);
+			position += size;
+			switch (type) {
+				case 'P': outcome.phase = data; break;
+				case 'E': outcome.error = data; break;
+				case 'O': outcome.output = std::move(data); break;
+			}
+		}
+	}
+
+	/// Current size of the address space, which the memory limit adds to
+	static rlim_t addressSpace() {
+		std::ifstream statm("/proc/self/statm");
+		rlim_t pages = 0;
+		statm >> pages;
+		return pages * sysconf(_SC_PAGESIZE);
+	}
+
+	static constexpr long _bounds[] = {10, 30, 100, 300, 1000, 3000, 10000, 30000, 100000};
+	unsigned _timeLimitMs;
+	unsigned _memoryLimitMb;
+	std::mutex _mutex;
+	std::vector<unsigned> _histogram;
+	unsigned _overTime = 0;
+	unsigned _overMemory = 0;
+	unsigned _crashed = 0;
+};
+constexpr long DocumentBudget::_bounds[];
+
+/// A record travelling along the batch pipeline
+struct BatchRecord {
+	unsigned index;
+	YAML::Node data;
+	std::unique_ptr<FormDocument> form;
+	QByteArray output;
+	Clock::time_point start;
+};
+
+/// Fills a template once per record of a multi-document YAML stream.
+/// Parsing, filling, serializing and writing run as separate stages
+/// connected by bounded queues so disk and cpu work overlap.
+/// Loaded templates are reused, restoring just the fields each record changed.
+/// With budget limits, each record is filled and serialized by a child
+/// process on its copy of the template, which needs no restore then.
+class BatchFiller {
+public:
+	BatchFiller(const QByteArray & templateData, const std::string & outputPattern, unsigned queueDepth, bool radioGroups, DocumentBudget & budget)
+		: _template(templateData)
+		, _outputPattern(outputPattern)
+		, _queueDepth(queueDepth?queueDepth:1)
+		, _parsed("parsed", _queueDepth)
+		, _filled("filled", _queueDepth)
+		, _serialized("serialized", _queueDepth)
+		// One being filled, one being serialized and the ones in between
+		, _templates("templates", _queueDepth+2)
+		, _radioGroups(radioGroups)
+		, _budget(budget)
+	{}
+
+	void run(std::istream & records) {
+		auto start = Clock::now();
+		for (unsigned i=0; i<_queueDepth+2; i++) {
+			std::unique_ptr<FormDocument> form(new FormDocument);
+			form->load(_template) or fail("Unable to open the document");
+			form->discover(_radioGroups);
+			_templates.push(std::move(form));
+		}
+		std::thread filler([this]{ timed(_fillTime, [this]{ fillStage(); }); });
+		std::thread serializer([this]{ timed(_serializeTime, [this]{ serializeStage(); }); });
+		std::thread writer([this]{ timed(_writeTime, [this]{ writeStage(); }); });
+		timed(_parseTime, [&]{ parseStage(records); });
+		filler.join();
+		serializer.join();
+		writer.join();
+		_totalTime = Clock::now() - start;
+	}
+
+	unsigned written() const { return _written; }
+	unsigned failed() const { return _failed; }
+
+	void report(YAML::Emitter & out) {
+		out << YAML::Key << "pipeline" << YAML::Value << YAML::BeginMap;
+		out << "records" << _written + _failed;
+		out << "written" << _written;
+		out << "failed" << _failed;
+		out << "total_ms" << milliseconds(_totalTime);
+		out << YAML::Key << "stages" << YAML::Value << YAML::BeginMap;
+		out << "parse_ms" << milliseconds(_parseTime);
+		out << "fill_ms" << milliseconds(_fillTime);
+		out << "serialize_ms" << milliseconds(_serializeTime);
+		out << "write_ms" << milliseconds(_writeTime);
+		out << YAML::EndMap;
+		out << YAML::Key << "queues" << YAML::Value << YAML::BeginMap;
+		_parsed.report(out);
+		_filled.report(out);
+		_serialized.report(out);
+		_templates.report(out);
+		out << YAML::EndMap;
+		out << YAML::Key << "snapshot" << YAML::Value << YAML::BeginMap;
+		out << "restores" << _restores;
+		out << "restored_fields" << _restoredFields;
+		out << YAML::EndMap;
+		out << YAML::EndMap;
+	}
+
+private:
+	using Queue = BoundedQueue<std::unique_ptr<BatchRecord>>;
+
+	template <typename Function>
+	static void timed(Clock::duration & elapsed, Function function) {
+		auto start = Clock::now();
+		function();
+		elapsed = Clock::now() - start;
+	}
+
+	void failed(unsigned index, const std::string & message) {
+		error("Record {}: {}", index, message);
+		std::lock_guard<std::mutex> lock(_countMutex);
+		_failed++;
+	}
+
+	void parseStage(std::istream & input) {
+		RecordReader reader(input);
+		while (true) {
+			auto record = std::unique_ptr<BatchRecord>(new BatchRecord);
+			try {
+				if (not reader.next(record->data)) break;
+			}
+			catch (YAML::Exception & e) {
+				failed(reader.index(), e.what());
+				continue;
+			}
+			record->index = reader.index();
+			_parsed.push(std::move(record));
+		}
+		_parsed.close();
+	}
+
+	void fillStage() {
+		std::unique_ptr<BatchRecord> record;
+		while (_parsed.pop(record)) {
+			if (_budget.limited()) {
+				isolatedFill(std::move(record));
+				continue;
+			}
+			record->start = Clock::now();
+			_templates.pop(record->form);
+			try {
+				record->form->fill(record->data);
+			}
+			catch (YAML::Exception & e) {
+				failed(record->index, e.what());
+				recycle(std::move(record->form));
+				continue;
+			}
+			_filled.push(std::move(record));
+		}
+		_filled.close();
+	}
+
+	/// Fills and serializes within the budget, so the record
+	/// goes straight to the write stage
+	void isolatedFill(std::unique_ptr<BatchRecord> record) {
+		_templates.pop(record->form);
+		FormDocument & form = *record->form;
+		auto outcome = _budget.run([&](DocumentTask & task) {
+			task.phase("fill");
+			form.fill(record->data);
+			task.phase("serialize");
+			QByteArray output;
+			QBuffer buffer(&output);
+			if (not form.save(&buffer))
+				throw std::runtime_error("Unable to generate the filled pdf");
+			task.output(output.constData(), output.size());
+		});
+		_templates.push(std::move(record->form));
+		if (not outcome.ok) {
+			failed(record->index, outcome.error);
+			return;
+		}
+		record->output = QByteArray(outcome.output.data(), outcome.output.size());
+		_serialized.push(std::move(record));
+	}
+
+	void serializeStage() {
+		std::unique_ptr<BatchRecord> record;
+		while (_filled.pop(record)) {
+			QBuffer buffer(&record->output);
+			bool ok = record->form->save(&buffer);
+			recycle(std::move(record->form));
+			_budget.record(Clock::now() - record->start);
+			if (not ok) {
+				failed(record->index, "Unable to generate the filled pdf");
+				continue;
+			}
+			_serialized.push(std::move(record));
+		}
+		_serialized.close();
+	}
+
+	/// Resets a filled template and makes it available for another record
+	void recycle(std::unique_ptr<FormDocument> form) {
+		unsigned restored = form->restore();
+		{
+			std::lock_guard<std::mutex> lock(_countMutex);
+			_restores++;
+			_restoredFields += restored;
+		}
+		_templates.push(std::move(form));
+	}
+
+	void writeStage() {
+		std::unique_ptr<BatchRecord> record;
+		while (_serialized.pop(record)) {
+			std::string filename = fmt::format(_outputPattern, record->index);
+			std::ofstream output(filename.c_str(), std::ios::binary);
+			output.write(record->output.constData(), record->output.size());
+			output.close();
+			if (not output) {
+				failed(record->index, fmt::format("Error saving file {}", filename));
+				continue;
+			}
+			_written++;
+		}
+	}
+
+	QByteArray _template;
+	std::string _outputPattern;
+	unsigned _queueDepth;
+	Queue _parsed;
+	Queue _filled;
+	Queue _serialized;
+	BoundedQueue<std::unique_ptr<FormDocument>> _templates;
+	bool _radioGroups;
+	DocumentBudget & _budget;
+	std::mutex _countMutex;
+	unsigned _written = 0;
+	unsigned _failed = 0;
+	unsigned _restores = 0;
+	unsigned _restoredFields = 0;
+	Clock::duration _parseTime = Clock::duration::zero();
+	Clock::duration _fillTime = Clock::duration::zero();
+	Clock::duration _serializeTime = Clock::duration::zero();
+	Clock::duration _writeTime = Clock::duration::zero();
+	Clock::duration _totalTime = Clock::duration::zero();
+};
+
+/// Writes the statistics sections added by the reporter as a YAML map
+template <typename Reporter>
+void writeStats(const QString & statsFile, Reporter reporter)
+{
+	if (statsFile.isEmpty()) return;
+	std::ofstream stats(statsFile.toStdString().c_str());
+	YAML::Emitter out(stats);
+	out << YAML::BeginMap;
+	reporter(out);
+	out << YAML::EndMap;
+	out << YAML::Newline;
+}
+
+/// MurmurHash64A, fast enough to hash whole PDFs on each run
+static quint64 hashBytes(const uchar * data, qint64 size, quint64 seed=0)
+{
+	const quint64 m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	quint64 h = seed ^ (quint64(size) * m);
+	const uchar * end = data + (size & ~qint64(7));
+	for (const uchar * p = data; p != end; p += 8) {
+		quint64 k;
+		std::memcpy(&k, p, 8);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+	switch (size & 7) {
+		case 7: h ^= quint64(end[6]) << 48; // fall through
+		case 6: h ^= quint64(end[5]) << 40; // fall through
+		case 5: h ^= quint64(end[4]) << 32; // fall through
+		case 4: h ^= quint64(end[3]) << 24; // fall through
+		case 3: h ^= quint64(end[2]) << 16; // fall through
+		case 2: h ^= quint64(end[1]) << 8; // fall through
+		case 1: h ^= quint64(end[0]);
+			h *= m;
+	}
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+/// On disk cache of extraction outputs, keyed by the hash of the PDF
+/// content and the extraction options. When the entries exceed the
+/// size limit, the least recently used ones are evicted.
+class ExtractionCache {
+public:
+	/// Part of every key. Bump it whenever the extraction output
+	/// changes, so entries stored by older versions are not served.
+	static constexpr unsigned format = 2;
+
+	ExtractionCache(const QString & directory, qint64 maxBytes)
+		: _directory(directory)
+		, _maxBytes(maxBytes)
+	{
+		_directory.mkpath(".") or fail("Unable to create cache directory {}", directory);
+	}
+
+	/// Returns the entry key for the pdf or an empty key if unreadable
+	QString key(const QString & pdf, const std::string & options) const {
+		QFile file(pdf);
+		if (not file.open(QIODevice::ReadOnly)) return QString();
+		qint64 size = file.size();
+		uchar * data = size? file.map(0, size) : nullptr;
+		if (size and not data) return QString();
+		quint64 contentHash = hashBytes(data, size);
+		if (data) file.unmap(data);
+		quint64 optionsHash = hashBytes(
+			reinterpret_cast<const uchar*>(options.data()), options.size());
+		return QString::fromStdString(fmt::format("{:016x}{:016x}", contentHash, optionsHash));
+	}
+
+	bool fetch(const QString & key, std::ostream & output) {
+		std::string path = entry(key);
+		std::ifstream cached(path.c_str(), std::ios::binary);
+		if (not cached) {
+			_misses++;
+			return false;
+		}
+		output << cached.rdbuf();
+		utime(path.c_str(), nullptr); // Recently used
+		_hits++;
+		return true;
+	}
+
+	void store(const QString & key, const std::string & content) {
+		std::string path = entry(key);
+		std::string temporary = fmt::format("{}.{}.tmp", path, getpid());
+		std::ofstream output(temporary.c_str(), std::ios::binary);
+		output << content;
+		output.close();
+		if (not output or std::rename(temporary.c_str(), path.c_str())) {
+			warn("Unable to store cache entry {}", path);
+			std::remove(temporary.c_str());
+			return;
+		}
+		evict();
+	}
+
+	/// Adds this run counters to the totals kept in the cache directory
+	void persistCounters() {
+		std::string path = _directory.filePath("counters.yaml").toStdString();
+		std::string lockPath = path + ".lock";
+		int lock = open(lockPath.c_str(), O_CREAT | O_RDWR, 0644);
+		if (lock != -1) flock(lock, LOCK_EX);
+		YAML::Node totals;
+		try {
+			totals = YAML::LoadFile(path);
+		}
+		catch (YAML::Exception &) {}
+		_totalHits = totals["hits"].as<unsigned long>(0) + _hits;
+		_totalMisses = totals["misses"].as<unsigned long>(0) + _misses;
+		_totalEvictions = totals["evictions"].as<unsigned long>(0) + _evictions;
+		std::ofstream output(path.c_str());
+		YAML::Emitter out(output);
+		out << YAML::BeginMap;
+		out << "hits" << _totalHits;
+		out << "misses" << _totalMisses;
+		out << "evictions" << _totalEvictions;
+		out << YAML::EndMap;
+		out << YAML::Newline;
+		if (lock != -1) close(lock);
+	}
+
+	void report(YAML::Emitter & out) const {
+		out << YAML::Key << "cache" << YAML::Value << YAML::BeginMap;
+		out << "hits" << _hits;
+		out << "misses" << _misses;
+		out << "evictions" << _evictions;
+		out << "total_hits" << _totalHits;
+		out << "total_misses" << _totalMisses;
+		out << "total_evictions" << _totalEvictions;
+		out << YAML::EndMap;
+	}
+
+private:
+	std::string entry(const QString & key) const {
+		return _directory.filePath(key + ".entry").toStdString();
+	}
+
+	void evict() {
+		// Oldest access first
+		auto entries = _directory.entryInfoList(
+			QStringList{"*.entry"},
+			QDir::Files, QDir::Time | QDir::Reversed);
+		qint64 total = 0;
+		for (auto & info : entries) total += info.size();
+		for (auto & info : entries) {
+			if (total <= _maxBytes) break;
+			if (not QFile::remove(info.filePath())) continue;
+			total -= info.size();
+			_evictions++;
+		}
+	}
+
+	QDir _directory;
+	qint64 _maxBytes;
+	unsigned long _hits = 0;
+	unsigned long _misses = 0;
+	unsigned long _evictions = 0;
+	unsigned long _totalHits = 0;
+	unsigned long _totalMisses = 0;
+	unsigned long _totalEvictions = 0;
 };
+constexpr unsigned ExtractionCache::format;
 
 int extractYamlFromPdf(FieldTree & fields, std::ostream & outputfile)
 {
+	// Kept between documents, so each thread allocates it just once
+	static thread_local std::string buffer;
+	buffer.clear();
+	buffer.reserve(1<<20);
+	YamlWriter out(buffer);
+	out.comment(QStringLiteral("Generated by pdf-form-burner"));
+	fields.extract(out);
+	out.newline();
+	outputfile.write(buffer.data(), buffer.size());
+	return 0;
+}
+
+int exportSchema(FieldTree & fields, std::ostream & outputfile)
+{
+	FormSchema schema;
+	fields.schema(schema);
 	YAML::Emitter out(outputfile);
 	out << YAML::Comment("Generated by pdf-form-burner");
-	fields.extract(out);
+	schema.emit(out);
 	out << YAML::Newline;
 	return 0;
 }
 
+int validateRecords(const QString & schemaFile, const QStringList & recordFiles)
+{
+	recordFiles.empty() and fail("No record files given to validate");
+	stage("Loading schema {}", schemaFile);
+	FormSchema schema;
+	try {
+		schema.load(YAML::LoadFile(schemaFile.toStdString()));
+	}
+	catch (YAML::Exception & e) {
+		fail("Unable to load schema {}: {}", schemaFile, e.what());
+	}
+	unsigned total = 0;
+	unsigned rejected = 0;
+	for (auto recordFile : recordFiles) {
+		stage("Validating {}", recordFile);
+		std::ifstream file;
+		if (recordFile != "-") {
+			file.open(recordFile.toStdString().c_str());
+			file or fail("Unable to open {}", recordFile);
+		}
+		RecordReader records(recordFile == "-" ? std::cin : file);
+		std::vector<std::string> problems;
+		while (true) {
+			YAML::Node record;
+			try {
+				if (not records.next(record)) break;
+			}
+			catch (YAML::Exception & e) {
+				problems.push_back(fmt::format("Bad YAML: {}", e.what()));
+			}
+			total++;
+			schema.validate(record, problems);
+			if (problems.empty()) continue;
+			rejected++;
+			for (auto & problem : problems) {
+				error("{} record {}: {}", recordFile, records.index(), problem);
+			}
+			problems.clear();
+		}
+	}
+	stage("Validated {} records, {} rejected", total, rejected);
+	return rejected? 1 : 0;
+}
+
+/// PDF text string, UTF-16BE with byte order mark
+static GooString * pdfText(const std::string & utf8)
+{
+	QString text = QString::fromStdString(utf8);
+	GooString * result = new GooString;
+	result->append('\xfe');
+	result->append('\xff');
+	for (int i=0; i<text.size(); i++) {
+		ushort c = text.utf16()[i];
+		result->append(char(c>>8));
+		result->append(char(c&0xff));
+	}
+	return result;
+}
+
+static QString fromPdfText(const GooString * text)
+{
+	if (not text) return QString();
+	const char * data = text->c_str();
+	int length = text->getLength();
+	if (length<2 or uchar(data[0])!=0xfe or uchar(data[1])!=0xff) {
+		return QString::fromLatin1(data, length);
+	}
+	QString result;
+	for (int i=2; i+1<length; i+=2) {
+		result += QChar(ushort(uchar(data[i])<<8 | uchar(data[i+1])));
+	}
+	return result;
+}
+
+/// Compresses input into output a chunk at a time,
+/// so memory stays bounded whatever the file size
+static bool deflateFile(const std::string & input, const std::string & output, qint64 & inputSize, qint64 & outputSize)
+{
+	std::ifstream in(input.c_str(), std::ios::binary);
+	if (not in) return false;
+	std::ofstream out(output.c_str(), std::ios::binary);
+	if (not out) return false;
+	z_stream stream;
+	std::memset(&stream, 0, sizeof(stream));
+	if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK) return false;
+	const unsigned chunk = 256*1024;
+	std::vector<char> inBuffer(chunk);
+	std::vector<char> outBuffer(chunk);
+	inputSize = 0;
+	outputSize = 0;
+	int flush = Z_NO_FLUSH;
+	while (flush != Z_FINISH) {
+		in.read(inBuffer.data(), chunk);
+		if (in.bad()) break;
+		stream.next_in = reinterpret_cast<Bytef*>(inBuffer.data());
+		stream.avail_in = in.gcount();
+		inputSize += in.gcount();
+		flush = in.eof()? Z_FINISH : Z_NO_FLUSH;
+		do {
+			stream.next_out = reinterpret_cast<Bytef*>(outBuffer.data());
+			stream.avail_out = chunk;
+			deflate(&stream, flush);
+			unsigned produced = chunk - stream.avail_out;
+			out.write(outBuffer.data(), produced);
+			outputSize += produced;
+		} while (stream.avail_out == 0);
+	}
+	deflateEnd(&stream);
+	out.close();
+	return flush == Z_FINISH and bool(out);
+}
+
+/// Adds the entries of the name tree under node, keyed by their raw
+/// text string so they come out in name tree order.
+static void collectNames(const Object & node, std::map<std::string, Object> & entries, unsigned depth=0)
+{
+	if (not node.isDict() or depth>32) return;
+	Object names = node.dictLookup("Names");
+	if (names.isArray()) {
+		Array * array = names.getArray();
+		for (int i=0; i+1<array->getLength(); i+=2) {
+			Object key = array->get(i);
+			if (not key.isString()) continue;
+			const GooString * text = key.getString();
+			entries[std::string(text->c_str(), text->getLength())] = array->getNF(i+1).copy();
+		}
+	}
+	Object kids = node.dictLookup("Kids");
+	if (not kids.isArray()) return;
+	Array * array = kids.getArray();
+	for (int i=0; i<array->getLength(); i++)
+		collectNames(array->get(i), entries, depth+1);
+}
+
+/// Embeds the files as attachments of the pdf, named after their fields.
+/// poppler-qt5 cannot add attachments, so this uses the poppler core API
+/// on the already saved pdf. Files are deflated into temporary files
+/// and copied from there on save, so none is ever held in memory.
+/// Previous attachments are kept, unless a field replaces them,
+/// and the EmbeddedFiles tree is rebuilt as a single sorted root.
+bool embedFiles(const QString & pdf, const std::vector<Attachment> & attachments)
+{
+	if (attachments.empty()) return true;
+	std::string pdfPath = pdf.toStdString();
+	GooString pdfName(pdfPath.c_str());
+	std::unique_ptr<PDFDoc> doc(PDFDocFactory().createPDFDoc(pdfName));
+	if (not doc or not doc->isOk()) return false;
+	XRef * xref = doc->getXRef();
+
+	Object catalog = xref->getCatalog();
+	Object oldNames = catalog.dictLookup("Names");
+	std::map<std::string, Object> entries;
+	if (oldNames.isDict())
+		collectNames(oldNames.dictLookup("EmbeddedFiles"), entries);
+
+	std::vector<std::string> temporaries;
+	std::vector<std::unique_ptr<GooFile>> files;
+	auto discard = [&]() {
+		doc.reset();
+		files.clear();
+		for (auto & temporary : temporaries) std::remove(temporary.c_str());
+	};
+	for (unsigned i=0; i<attachments.size(); i++) {
+		auto & attachment = attachments[i];
+		std::string compressed = fmt::format("{}.{}.deflate", pdfPath, i);
+		temporaries.push_back(compressed);
+		qint64 size = 0;
+		qint64 compressedSize = 0;
+		bool deflated = deflateFile(attachment.path, compressed, size, compressedSize);
+		GooString compressedName(compressed.c_str());
+		if (deflated) files.emplace_back(GooFile::open(&compressedName));
+		if (not deflated or not files.back()) {
+			error("Unable to embed file '{}' of field '{}'",
+				attachment.path, attachment.field);
+			discard();
+			return false;
+		}
+
+		Dict * params = new Dict(xref);
+		params->add("Size", Object(static_cast<long long>(size)));
+		Dict * streamDict = new Dict(xref);
+		streamDict->add("Type", Object(objName, "EmbeddedFile"));
+		streamDict->add("Filter", Object(objName, "FlateDecode"));
+		streamDict->add("Length", Object(static_cast<long long>(compressedSize)));
+		streamDict->add("Params", Object(params));
+		// Stream reading the compressed file, copied as is on save
+		Object stream(static_cast<Stream*>(new FileStream(
+			files.back().get(), 0, true, compressedSize, Object(streamDict))));
+		Ref streamRef = xref->addIndirectObject(&stream);
+
+		std::string filename = QFileInfo(QString::fromStdString(attachment.path))
+			.fileName().toStdString();
+		Dict * embedded = new Dict(xref);
+		embedded->add("F", Object(streamRef.num, streamRef.gen));
+		Dict * spec = new Dict(xref);
+		spec->add("Type", Object(objName, "Filespec"));
+		spec->add("F", Object(pdfText(filename)));
+		spec->add("UF", Object(pdfText(filename)));
+		spec->add("Desc", Object(pdfText(attachment.field)));
+		spec->add("EF", Object(embedded));
+		Object specObject(spec);
+		Ref specRef = xref->addIndirectObject(&specObject);
+
+		std::unique_ptr<GooString> key(pdfText(attachment.field));
+		entries[std::string(key->c_str(), key->getLength())] =
+			Object(specRef.num, specRef.gen);
+	}
+
+	// A root holding all the names needs no Limits nor Kids
+	Array * names = new Array(xref);
+	for (auto & entry : entries) {
+		names->add(Object(new GooString(entry.first.data(), entry.first.size())));
+		names->add(std::move(entry.second));
+	}
+	Dict * tree = new Dict(xref);
+	tree->add("Names", Object(names));
+	Dict * newNames = new Dict(xref);
+	if (oldNames.isDict()) {
+		Dict * dict = oldNames.getDict();
+		for (int i=0; i<dict->getLength(); i++) {
+			if (std::string(dict->getKey(i)) == "EmbeddedFiles") continue;
+			newNames->add(dict->getKey(i), dict->getValNF(i).copy());
+		}
+	}
+	newNames->add("EmbeddedFiles", Object(tree));
+	catalog.dictSet("Names", Object(newNames));
+	Ref catalogRef;
+	catalogRef.num = xref->getRootNum();
+	catalogRef.gen = xref->getRootGen();
+	xref->setModifiedObject(&catalog, catalogRef);
+
+	std::string updated = pdfPath + ".embedding";
+	GooString updatedName(updated.c_str());
+	bool ok = doc->saveAs(&updatedName, writeStandard) == errNone;
+	discard();
+	if (ok) ok = std::rename(updated.c_str(), pdfPath.c_str()) == 0;
+	if (not ok) std::remove(updated.c_str());
+	return ok;
+}
+
+/// Writes the pdf attachments into the directory, streaming them
+/// from the document instead of loading them as poppler-qt5 does.
+void extractAttachments(const QString & pdf, const QString & directory)
+{
+	QDir target(directory);
+	target.mkpath(".") or fail("Unable to create directory {}", directory);
+	GooString pdfName(pdf.toStdString().c_str());
+	std::unique_ptr<PDFDoc> doc(PDFDocFactory().createPDFDoc(pdfName));
+	(doc and doc->isOk()) or fail("Unable to open the document");
+	Catalog * catalog = doc->getCatalog();
+	for (int i=0; i<catalog->numEmbeddedFiles(); i++) {
+		std::unique_ptr<FileSpec> spec(catalog->embeddedFile(i));
+		if (not spec or not spec->isOk()) continue;
+		EmbFile * file = spec->getEmbeddedFile();
+		if (not file or not file->isOk()) continue;
+		// Just the base name, never write outside the directory
+		QString name = QFileInfo(fromPdfText(spec->getFileName())
+			.replace("\\", "/")).fileName();
+		if (name.isEmpty()) name = QString("attachment-%1").arg(i+1);
+		QString path = target.filePath(name);
+		GooString pathName(path.toStdString().c_str());
+		if (not file->save(&pathName)) {
+			error("Unable to write attachment {}", path);
+			continue;
+		}
+		step("Extracted attachment {}", path);
+	}
+}
+
 void fillPdfWithYaml(FieldTree & fields, std::istream & yamlfile)
 {
 	YAML::Node node = YAML::Load(yamlfile);
 	fields.fill(node);
 }
 
+void loadForm(FormDocument & form, const QString & inputpdf, bool radioGroups, unsigned jobs=1)
+{
+	stage("Loading {}", inputpdf);
+	form.load(inputpdf) or fail("Unable to open the document");
+	form.document()->isLocked() and fail("Locked pdf");
+
+	stage("Looking for form fields");
+	form.discover(radioGroups, jobs);
+}
+
+int verifyRecord(const QString & inputpdf, const QString & recordFile, bool firstOnly, bool radioGroups)
+{
+	FormDocument form;
+	loadForm(form, inputpdf, radioGroups);
+	stage("Verifying {}", recordFile);
+	YAML::Node record;
+	try {
+		record = recordFile == "-"? YAML::Load(std::cin) :
+			YAML::LoadFile(recordFile.toStdString());
+	}
+	catch (YAML::Exception & e) {
+		fail("Unable to load record {}: {}", recordFile, e.what());
+	}
+	std::vector<Difference> differences;
+	form.fields().verify(record, differences, firstOnly);
+
+	YAML::Emitter out(std::cout);
+	out << YAML::BeginSeq;
+	for (auto & difference : differences) {
+		out << YAML::BeginMap;
+		out << "field" << difference.field;
+		if (difference.problem.empty()) {
+			out << "expected" << difference.expected;
+			out << "actual" << difference.actual;
+		}
+		else {
+			out << "problem" << difference.problem;
+		}
+		out << YAML::EndMap;
+	}
+	out << YAML::EndSeq;
+	out << YAML::Newline;
+	stage("Found {} differences", differences.size());
+	return differences.empty()? 0 : 1;
+}
+
+typedef int (*Extractor)(FieldTree & fields, std::ostream & output);
+
+int cachedExtract(ExtractionCache & cache, const QString & inputpdf, const std::string & options, bool radioGroups, unsigned jobs, Extractor extract, std::ostream & output)
+{
+	QString key = cache.key(inputpdf, options);
+	key.isEmpty() and fail("Unable to open the document");
+	if (cache.fetch(key, output)) {
+		step("Using cached extraction {}", key);
+		return 0;
+	}
+	FormDocument form;
+	loadForm(form, inputpdf, radioGroups, jobs);
+	std::ostringstream buffer;
+	int result = extract(form.fields(), buffer);
+	output << buffer.str();
+	cache.store(key, buffer.str());
+	return result;
+}
+
+/// CSV field, quoted when needed
+static std::string csvField(const std::string & value)
+{
+	if (value.find_first_of(",\"\r\n") == std::string::npos) return value;
+	std::string quoted = "\"";
+	for (auto c : value) {
+		if (c == '"') quoted += '"';
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+/// Extracts many PDFs of the same form into a single CSV table,
+/// a row per document and a column per field path.
+/// Documents are extracted concurrently but rows are written
+/// in input order as soon as they are ready. Workers stay at most
+/// a window of documents ahead, so memory does not grow with them.
+class TableExtractor {
+public:
+	TableExtractor(const QStringList & pdfs, std::ostream & output, unsigned workers, bool radioGroups, DocumentBudget & budget)
+		: _pdfs(pdfs)
+		, _output(output)
+		, _workers(workers?workers:1)
+		, _window(4*_workers)
+		, _radioGroups(radioGroups)
+		, _budget(budget)
+	{}
+
+	void run() {
+		auto start = Clock::now();
+		// The first document extracted defines the columns. Limited
+		// runs fork, so its values come back as the task output.
+		std::map<std::string, std::string> first;
+		unsigned index = 0;
+		for (; index < unsigned(_pdfs.size()); index++) {
+			auto outcome = _budget.run([&](DocumentTask & task) {
+				std::map<std::string, std::string> values;
+				extract(index, values, task);
+				task.output(joinPairs(values));
+			});
+			if (outcome.ok) {
+				first = splitPairs(outcome.output);
+				break;
+			}
+			error("{}: {}", _pdfs[index], outcome.error);
+			_failed++;
+		}
+		_output << "file";
+		for (auto & column : first) {
+			_columns.push_back(column.first);
+			_output << "," << csvField(column.first);
+		}
+		_output << "\n";
+		if (index < unsigned(_pdfs.size())) _output << row(index, first);
+		_next = index+1;
+		_written = index+1;
+
+		std::vector<std::thread> workers;
+		for (unsigned i=0; i<_workers; i++) {
+			workers.emplace_back([this]{ work(); });
+		}
+		for (auto & worker : workers) worker.join();
+		_output.flush();
+		_totalTime = Clock::now() - start;
+	}
+
+	unsigned failed() const { return _failed; }
+
+	void report(YAML::Emitter & out) {
+		out << YAML::Key << "aggregate" << YAML::Value << YAML::BeginMap;
+		out << "documents" << _pdfs.size();
+		out << "columns" << _columns.size();
+		out << "failed" << _failed;
+		out << "max_pending_rows" << _maxPending;
+		out << "total_ms" << milliseconds(_totalTime);
+		out << YAML::EndMap;
+	}
+
+private:
+	void extract(unsigned index, std::map<std::string, std::string> & values, DocumentTask & task) {
+		FormDocument form;
+		task.phase("load");
+		if (not form.load(_pdfs[index]))
+			throw std::runtime_error("Unable to open the document");
+		if (form.document()->isLocked())
+			throw std::runtime_error("Locked pdf");
+		task.phase("discover");
+		form.discover(_radioGroups);
+		task.phase("flatten");
+		form.fields().flatten(values);
+	}
+
+	/// Field paths and values, each ended by a null character
+	static std::string joinPairs(const std::map<std::string, std::string> & values) {
+		std::string pairs;
+		for (auto & value : values) {
+			pairs += value.first + '\0';
+			pairs += value.second + '\0';
+		}
+		return pairs;
+	}
+
+	static std::map<std::string, std::string> splitPairs(const std::string & pairs) {
+		std::map<std::string, std::string> values;
+		for (size_t position = 0; position < pairs.size(); ) {
+			size_t separator = pairs.find('\0', position);
+			if (separator == std::string::npos) break;
+			size_t end = pairs.find('\0', separator+1);
+			if (end == std::string::npos) break;
+			values[pairs.substr(position, separator-position)] =
+				pairs.substr(separator+1, end-separator-1);
+			position = end+1;
+		}
+		return values;
+	}
+
+	std::string row(unsigned index, std::map<std::string, std::string> & values) {
+		std::string line = csvField(_pdfs[index].toStdString());
+		for (auto & column : _columns) {
+			line += ",";
+			auto value = values.find(column);
+			if (value == values.end()) continue;
+			line += csvField(value->second);
+			values.erase(value);
+		}
+		if (not values.empty()) {
+			warn("{} has {} fields not in the first document, ignored",
+				_pdfs[index], values.size());
+		}
+		return line + "\n";
+	}
+
+	void work() {
+		while (true) {
+			unsigned index;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_ahead.wait(lock, [this]{
+					return _next >= unsigned(_pdfs.size()) or _next < _written + _window;
+				});
+				if (_next >= unsigned(_pdfs.size())) return;
+				index = _next++;
+			}
+			auto outcome = _budget.run([&](DocumentTask & task) {
+				std::map<std::string, std::string> values;
+				extract(index, values, task);
+				task.output(row(index, values));
+			});
+			if (not outcome.ok) error("{}: {}", _pdfs[index], outcome.error);
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (not outcome.ok) _failed++;
+			// Failed documents leave an empty line, which writes no row
+			_pending[index] = outcome.ok? outcome.output : std::string();
+			if (_pending.size() > _maxPending) _maxPending = _pending.size();
+			// Write whatever is now in order
+			for (auto ready = _pending.begin();
+				ready != _pending.end() and ready->first == _written;
+				ready = _pending.erase(ready)) {
+				_output << ready->second;
+				_written++;
+			}
+			_ahead.notify_all();
+		}
+	}
+
+	QStringList _pdfs;
+	std::ostream & _output;
+	unsigned _workers;
+	unsigned _window;
+	bool _radioGroups;
+	DocumentBudget & _budget;
+	std::vector<std::string> _columns;
+	std::mutex _mutex;
+	std::condition_variable _ahead;
+	std::map<unsigned, std::string> _pending;
+	unsigned _next = 0;
+	unsigned _written = 0;
+	unsigned _failed = 0;
+	size_t _maxPending = 0;
+	Clock::duration _totalTime = Clock::duration::zero();
+};
+
+int aggregateExtract(const QStringList & pdfs, const QString & output, unsigned workers, bool radioGroups, DocumentBudget & budget, const QString & statsFile)
+{
+	std::ofstream file;
+	if (output != "-") {
+		file.open(output.toStdString().c_str());
+		file or fail("Unable to open {}", output);
+	}
+	stage("Extracting {} documents into {}", pdfs.size(), output);
+	TableExtractor table(pdfs, output == "-"? std::cout : file, workers, radioGroups, budget);
+	table.run();
+	stage("Extracted {} documents, {} failed", pdfs.size(), table.failed());
+	writeStats(statsFile, [&](YAML::Emitter & out) {
+		table.report(out);
+		budget.report(out);
+	});
+	return table.failed()? 1 : 0;
+}
+
+static volatile std::sig_atomic_t watchStopping = 0;
+static void stopWatching(int) { watchStopping = 1; }
+
+/// A file dropped into a watched folder
+struct WatchJob {
+	std::string path;
+	std::string name;
+	unsigned id = 0;
+	bool fill = false;
+	/// YAML filling the job: the dropped file itself when it fills
+	/// the template, the paired one when the dropped PDF is filled
+	std::string record;
+	Clock::time_point arrival;
+};
+
+/// Processes the files dropped into the watched folders with a pool
+/// of workers: PDFs are extracted and YAML records fill the template.
+/// A PDF with a YAML of the same name beside it is filled with it
+/// instead. Without a template, YAML files wait for their PDF.
+/// Outputs are moved complete into the results folder, failed inputs
+/// into the errors folder, along with a '.error' file explaining why.
+class HotFolder {
+public:
+	HotFolder(const QString & results, const QString & errors, const QByteArray & templateData, bool radioGroups, unsigned workers, DocumentBudget & budget)
+		: _results(results)
+		, _errors(errors)
+		, _template(templateData)
+		, _radioGroups(radioGroups)
+		, _workers(workers?workers:1)
+		, _jobs("jobs", 4*_workers)
+		, _budget(budget)
+	{
+		_results.mkpath(".") or fail("Unable to create directory {}", results);
+		_errors.mkpath(".") or fail("Unable to create directory {}", errors);
+	}
+
+	void run(const QStringList & inboxes) {
+		int inotify = inotify_init1(IN_CLOEXEC);
+		inotify != -1 or fail("Unable to watch folders");
+		std::map<int, QString> watched;
+		for (auto inbox : inboxes) {
+			int watch = inotify_add_watch(inotify, inbox.toStdString().c_str(),
+				IN_CLOSE_WRITE | IN_MOVED_TO);
+			watch != -1 or fail("Unable to watch {}", inbox);
+			watched[watch] = inbox;
+		}
+		// Loaded before any worker runs, since budget limits
+		// fork workers and poppler must not be busy meanwhile
+		std::vector<std::unique_ptr<FormDocument>> templates;
+		for (unsigned i=0; i<_workers; i++) {
+			templates.emplace_back();
+			if (_template.isEmpty()) continue;
+			templates.back().reset(new FormDocument);
+			templates.back()->load(_template) or fail("Unable to open the document");
+			templates.back()->discover(_radioGroups);
+		}
+		std::vector<std::thread> workers;
+		for (unsigned i=0; i<_workers; i++) {
+			workers.emplace_back([this, &templates, i]{ work(templates[i].get()); });
+		}
+		signal(SIGINT, stopWatching);
+		signal(SIGTERM, stopWatching);
+		// Files dropped while we were not watching
+		for (auto inbox : inboxes) scan(inbox);
+		stage("Watching {}", inboxes.join(", "));
+
+		alignas(inotify_event) char buffer[64*1024];
+		while (not watchStopping) {
+			pollfd input = {inotify, POLLIN, 0};
+			if (poll(&input, 1, 500) <= 0) continue;
+			ssize_t length = read(inotify, buffer, sizeof(buffer));
+			for (char * p = buffer; p < buffer + length; ) {
+				auto event = reinterpret_cast<const inotify_event*>(p);
+				p += sizeof(inotify_event) + event->len;
+				if (event->mask & IN_Q_OVERFLOW) {
+					warn("Too many events, rescanning");
+					for (auto inbox : inboxes) scan(inbox);
+					continue;
+				}
+				if (not event->len) continue;
+				enqueue(watched[event->wd], event->name);
+			}
+		}
+		stage("Stopping");
+		_jobs.close();
+		for (auto & worker : workers) worker.join();
+		close(inotify);
+	}
+
+	void report(YAML::Emitter & out) {
+		std::lock_guard<std::mutex> lock(_countMutex);
+		out << YAML::Key << "watch" << YAML::Value << YAML::BeginMap;
+		out << "processed" << _processed;
+		out << "failed" << _failed;
+		out << "latency_max_ms" << milliseconds(_maxLatency);
+		out << "latency_avg_ms" << (_processed+_failed?
+			milliseconds(_totalLatency)/(_processed+_failed) : 0);
+		out << YAML::EndMap;
+		_jobs.report(out);
+	}
+
+private:
+	void scan(const QString & inbox) {
+		auto files = QDir(inbox).entryList(QDir::Files, QDir::Time | QDir::Reversed);
+		for (auto file : files) enqueue(inbox, file);
+	}
+
+	void enqueue(const QString & inbox, const QString & filename) {
+		if (filename.startsWith(".")) return;
+		QFileInfo info(filename);
+		QString suffix = info.suffix().toLower();
+		WatchJob job;
+		job.path = QDir(inbox).filePath(filename).toStdString();
+		job.name = info.completeBaseName().toStdString();
+		if (suffix == "pdf") job.fill = false;
+		else if (suffix == "yaml" or suffix == "yml") {
+			// Filled along with its PDF, once that is processed
+			if (QDir(inbox).exists(QString::fromStdString(job.name+".pdf"))) return;
+			if (_template.isEmpty()) return;
+			job.fill = true;
+			job.record = job.path;
+		}
+		else return;
+		job.arrival = Clock::now();
+		{
+			// Rescans and repeated events report queued files again
+			std::lock_guard<std::mutex> lock(_pendingMutex);
+			if (not _pending.insert(job.path).second) return;
+			job.id = _nextId++;
+		}
+		_jobs.push(job);
+	}
+
+	void work(FormDocument * form) {
+		WatchJob job;
+		while (_jobs.pop(job)) {
+			// Removed meanwhile by someone else
+			if (not QFile::exists(QString::fromStdString(job.path))) {
+				forget(job);
+				continue;
+			}
+			if (not job.fill) {
+				job.record = pairedRecord(job);
+				job.fill = not job.record.empty();
+			}
+			auto outcome = _budget.run([&](DocumentTask & task) {
+				if (job.fill) fill(job, form, task);
+				else extract(job, task);
+			});
+			if (outcome.ok) {
+				if (job.fill and job.record != job.path) std::remove(job.record.c_str());
+				std::remove(job.path.c_str());
+				step("Processed {}", job.path);
+			}
+			else {
+				// Left behind by an aborted worker
+				std::remove(temporary(job).c_str());
+				reject(job, outcome.error);
+			}
+			done(job, outcome.ok);
+		}
+	}
+
+	/// The YAML beside a dropped PDF with its same name, if any
+	static std::string pairedRecord(const WatchJob & job) {
+		QDir inbox = QFileInfo(QString::fromStdString(job.path)).dir();
+		for (auto suffix : {".yaml", ".yml"}) {
+			QString record = QString::fromStdString(job.name) + suffix;
+			if (inbox.exists(record)) return inbox.filePath(record).toStdString();
+		}
+		return std::string();
+	}
+
+	/// The input is gone by now, a new file may take its name
+	void forget(const WatchJob & job) {
+		std::lock_guard<std::mutex> lock(_pendingMutex);
+		_pending.erase(job.path);
+	}
+
+	/// Unique per job, as inboxes may hold files with the same name
+	std::string temporary(const WatchJob & job) {
+		return _results.filePath(QString::fromStdString(fmt::format(
+			".{}.{}{}", job.name, job.id, job.fill?".pdf.tmp":".yaml.tmp"))).toStdString();
+	}
+
+	void extract(const WatchJob & job, DocumentTask & task) {
+		FormDocument form;
+		task.phase("load");
+		if (not form.load(QString::fromStdString(job.path)))
+			throw std::runtime_error("Unable to open the document");
+		if (form.document()->isLocked())
+			throw std::runtime_error("Locked pdf");
+		task.phase("discover");
+		form.discover(_radioGroups);
+		task.phase("extract");
+		std::string temporary = this->temporary(job);
+		std::ofstream output(temporary.c_str());
+		extractYamlFromPdf(form.fields(), output);
+		output.close();
+		if (not output) throw std::runtime_error("Unable to write the output");
+		task.phase("publish");
+		publish(temporary, _results.filePath(QString::fromStdString(job.name+".yaml")).toStdString());
+	}
+
+	void fill(const WatchJob & job, FormDocument * form, DocumentTask & task) {
+		FormDocument paired;
+		if (job.record != job.path) {
+			task.phase("load");
+			if (not paired.load(QString::fromStdString(job.path)))
+				throw std::runtime_error("Unable to open the document");
+			if (paired.document()->isLocked())
+				throw std::runtime_error("Locked pdf");
+			task.phase("discover");
+			paired.discover(_radioGroups);
+			form = &paired;
+		}
+		if (not form) throw std::runtime_error("No template given to fill records");
+		task.phase("parse");
+		YAML::Node record = YAML::LoadFile(job.record);
+		std::string temporary = this->temporary(job);
+		// Paired documents and the template copy of a forked worker
+		// are thrown away, just the template shared in place is reused
+		bool shared = form != &paired and not _budget.limited();
+		bool ok;
+		try {
+			task.phase("fill");
+			form->fill(record);
+			task.phase("save");
+			ok = form->save(QString::fromStdString(temporary));
+		}
+		catch (...) {
+			if (shared) form->restore();
+			throw;
+		}
+		if (shared) form->restore();
+		if (not ok) throw std::runtime_error("Unable to generate the filled pdf");
+		task.phase("publish");
+		publish(temporary, _results.filePath(QString::fromStdString(job.name+".pdf")).toStdString());
+	}
+
+	/// Renames into place, so readers never see a partial output
+	void publish(const std::string & temporary, const std::string & target) {
+		if (std::rename(temporary.c_str(), target.c_str())) {
+			std::remove(temporary.c_str());
+			throw std::runtime_error("Unable to move the output to "+target);
+		}
+	}
+
+	void reject(const WatchJob & job, const std::string & message) {
+		error("{}: {}", job.path, message);
+		QString filename = QFileInfo(QString::fromStdString(job.path)).fileName();
+		std::string errorFile = _errors.filePath(filename+".error").toStdString();
+		std::string temporary = _errors.filePath(QString::fromStdString(fmt::format(
+			".{}.{}.error.tmp", filename, job.id))).toStdString();
+		{
+			std::ofstream output(temporary.c_str());
+			output << message << std::endl;
+		}
+		std::rename(temporary.c_str(), errorFile.c_str());
+		std::string moved = _errors.filePath(filename).toStdString();
+		if (std::rename(job.path.c_str(), moved.c_str())) {
+			warn("Unable to move {} into {}", job.path, moved);
+		}
+		if (not job.fill or job.record == job.path) return;
+		// The paired record goes along with its PDF
+		std::string record = _errors.filePath(
+			QFileInfo(QString::fromStdString(job.record)).fileName()).toStdString();
+		if (std::rename(job.record.c_str(), record.c_str())) {
+			warn("Unable to move {} into {}", job.record, record);
+		}
+	}
+
+	void done(const WatchJob & job, bool ok) {
+		auto latency = Clock::now() - job.arrival;
+		forget(job);
+		std::lock_guard<std::mutex> lock(_countMutex);
+		if (ok) _processed++;
+		else _failed++;
+		_totalLatency += latency;
+		if (latency > _maxLatency) _maxLatency = latency;
+	}
+
+	QDir _results;
+	QDir _errors;
+	QByteArray _template;
+	bool _radioGroups;
+	unsigned _workers;
+	BoundedQueue<WatchJob> _jobs;
+	DocumentBudget & _budget;
+	std::mutex _pendingMutex;
+	std::set<std::string> _pending;
+	unsigned _nextId = 0;
+	std::mutex _countMutex;
+	unsigned _processed = 0;
+	unsigned _failed = 0;
+	Clock::duration _totalLatency = Clock::duration::zero();
+	Clock::duration _maxLatency = Clock::duration::zero();
+};
+
+int watchFolders(const QStringList & inboxes, const QString & results, const QString & errors, const QString & templatePdf, unsigned workers, bool radioGroups, DocumentBudget & budget, const QString & statsFile)
+{
+	QByteArray templateData;
+	if (not templatePdf.isEmpty()) {
+		stage("Loading {}", templatePdf);
+		QFile pdf(templatePdf);
+		pdf.open(QIODevice::ReadOnly) or fail("Unable to open the document");
+		templateData = pdf.readAll();
+		FormDocument form;
+		form.load(templateData) or fail("Unable to open the document");
+		form.document()->isLocked() and fail("Locked pdf");
+	}
+	HotFolder folder(results, errors.isEmpty()? results : errors,
+		templateData, radioGroups, workers, budget);
+	folder.run(inboxes);
+	writeStats(statsFile, [&](YAML::Emitter & out) {
+		folder.report(out);
+		budget.report(out);
+	});
+	return 0;
+}
+
+int batchFill(const QString & inputpdf, const QString & recordFile, const QString & outputPattern, unsigned queueDepth, bool radioGroups, DocumentBudget & budget, const QString & statsFile)
+{
+	stage("Loading {}", inputpdf);
+	QFile pdf(inputpdf);
+	pdf.open(QIODevice::ReadOnly) or fail("Unable to open the document");
+	QByteArray templateData = pdf.readAll();
+	{
+		FormDocument form;
+		form.load(templateData) or fail("Unable to open the document");
+		form.document()->isLocked() and fail("Locked pdf");
+	}
+
+	std::ifstream file;
+	if (recordFile != "-") {
+		file.open(recordFile.toStdString().c_str());
+		file or fail("Unable to open {}", recordFile);
+	}
+	// Bad patterns would throw within the writer thread
+	try {
+		fmt::format(outputPattern.toStdString(), 1) != fmt::format(outputPattern.toStdString(), 2)
+			or fail("Output pattern '{}' gives the same file for every record, use '{{}}' for the record number", outputPattern);
+	}
+	catch (fmt::format_error & e) {
+		fail("Bad output pattern '{}': {}", outputPattern, e.what());
+	}
+
+	stage("Filling records from {}", recordFile);
+	BatchFiller batch(templateData, outputPattern.toStdString(), queueDepth, radioGroups, budget);
+	batch.run(recordFile == "-" ? std::cin : file);
+	stage("Filled {} records, {} failed", batch.written(), batch.failed());
+
+	writeStats(statsFile, [&](YAML::Emitter & out) {
+		batch.report(out);
+		budget.report(out);
+	});
+	return batch.failed()? 1 : 0;
+}
 
 int main(int argc, char**argv)
 {
@@ -414,38 +3178,173 @@ int main(int argc, char**argv)
 		translate("YAML file with the form data to write/read. Use a hyphen to use stdin/stdout"));
 	parser.addPositionalArgument("output.pdf",
 		translate("Filled PDF file. If provided, activates the fill mode and uses the YAML as input"), "[output.pdf]");
+	QCommandLineOption schemaOption("export-schema",
+		translate("Instead of the form data, writes into data.yaml the field schema: paths, types, allowed values..."));
+	parser.addOption(schemaOption);
+	QCommandLineOption validateOption("validate",
+		translate("Checks the records in the YAML files given as arguments against a schema generated with --export-schema. No PDF is loaded."),
+		"schema.yaml");
+	parser.addOption(validateOption);
+	QCommandLineOption batchOption("batch",
+		translate("Fill mode for many records: data.yaml holds several YAML documents and output.pdf is a pattern where '{}' is replaced by the record number, as in 'filled-{:04}.pdf'"));
+	parser.addOption(batchOption);
+	QCommandLineOption queueDepthOption("queue-depth",
+		translate("Maximum records waiting between batch stages"),
+		"records", "4");
+	parser.addOption(queueDepthOption);
+	QCommandLineOption statsOption("stats",
+		translate("Writes processing statistics as YAML into the given file"),
+		"stats.yaml");
+	parser.addOption(statsOption);
+	QCommandLineOption radioGroupsOption("radio-groups",
+		translate("Handles each group of radio buttons as a single value, the caption of the selected button, instead of a boolean for each button"));
+	parser.addOption(radioGroupsOption);
+	QCommandLineOption cacheOption("cache",
+		translate("Reuses extractions of PDFs with the same content and options, kept in the given directory"),
+		"directory");
+	parser.addOption(cacheOption);
+	QCommandLineOption cacheSizeOption("cache-size",
+		translate("Maximum size of the extraction cache, least recently used entries are evicted"),
+		"megabytes", "256");
+	parser.addOption(cacheSizeOption);
+	QCommandLineOption jobsOption("jobs",
+		translate("Threads scanning the pages for fields on extraction"),
+		"threads", "1");
+	parser.addOption(jobsOption);
+	QCommandLineOption embedFilesOption("embed-files",
+		translate("On fill, embeds the files named by FileSelect fields as attachments"));
+	parser.addOption(embedFilesOption);
+	QCommandLineOption extractFilesOption("extract-files",
+		translate("On extraction, also writes the attached files into the given directory"),
+		"directory");
+	parser.addOption(extractFilesOption);
+	QCommandLineOption watchOption("watch",
+		translate("Watches the folder, extracting the PDFs and filling input.pdf with the YAML files dropped in it. Can be repeated. Runs until interrupted."),
+		"directory");
+	parser.addOption(watchOption);
+	QCommandLineOption resultsOption("results",
+		translate("Folder receiving the outputs of --watch"),
+		"directory", "results");
+	parser.addOption(resultsOption);
+	QCommandLineOption errorsOption("errors",
+		translate("Folder receiving the failed inputs of --watch and the reason, by default the results folder"),
+		"directory");
+	parser.addOption(errorsOption);
+	QCommandLineOption workersOption("workers",
+		translate("Files processed at once by --watch"),
+		"threads", QString::number(std::max(1u, std::thread::hardware_concurrency())));
+	parser.addOption(workersOption);
+	QCommandLineOption aggregateOption("aggregate",
+		translate("Extracts all the PDFs given as arguments, instances of the same form, into a CSV table with a row per document and a column per field. Use a hyphen for stdout."),
+		"table.csv");
+	parser.addOption(aggregateOption);
+	QCommandLineOption verifyOption("verify",
+		translate("Instead of filling, compares the fields in input.pdf with the record in data.yaml and writes the differences as YAML to stdout. Fails if any."));
+	parser.addOption(verifyOption);
+	QCommandLineOption firstDifferenceOption("first-difference",
+		translate("Stops verifying at the first difference"));
+	parser.addOption(firstDifferenceOption);
+	QCommandLineOption timeLimitOption("time-limit",
+		translate("Maximum time to process each document of --batch, --aggregate and --watch. Documents over it fail. 0 for no limit."),
+		"milliseconds", "0");
+	parser.addOption(timeLimitOption);
+	QCommandLineOption memoryLimitOption("memory-limit",
+		translate("Maximum memory to process each document of --batch, --aggregate and --watch. Documents over it fail. 0 for no limit."),
+		"megabytes", "0");
+	parser.addOption(memoryLimitOption);
 	parser.process(app);
 	auto arguments = parser.positionalArguments();
+	DocumentBudget budget(parser.value(timeLimitOption).toUInt(),
+		parser.value(memoryLimitOption).toUInt());
+	fileSelectsAttached = parser.isSet(embedFilesOption) or parser.isSet(extractFilesOption);
+
+	if (parser.isSet(validateOption)) {
+		return validateRecords(parser.value(validateOption), arguments);
+	}
+
+	if (parser.isSet(watchOption)) {
+		return watchFolders(parser.values(watchOption),
+			parser.value(resultsOption),
+			parser.value(errorsOption),
+			arguments.empty()? QString() : arguments[0],
+			parser.value(workersOption).toUInt(),
+			parser.isSet(radioGroupsOption),
+			budget,
+			parser.value(statsOption));
+	}
 
 	if (arguments.length()<1) {
 		parser.showHelp(-1);
 	}
+
+	if (parser.isSet(aggregateOption)) {
+		return aggregateExtract(arguments,
+			parser.value(aggregateOption),
+			parser.value(workersOption).toUInt(),
+			parser.isSet(radioGroupsOption),
+			budget,
+			parser.value(statsOption));
+	}
 	auto inputpdf = arguments[0];
 
-	stage("Loading {}", inputpdf);
-	auto document = std::unique_ptr<Poppler::Document>(Poppler::Document::load(inputpdf));
+	if (parser.isSet(verifyOption)) {
+		arguments.length()==2 or fail("Verify mode requires input.pdf and data.yaml");
+		return verifyRecord(inputpdf, arguments[1],
+			parser.isSet(firstDifferenceOption),
+			parser.isSet(radioGroupsOption));
+	}
 
-	document or fail("Unable to open the document");
-	document->isLocked() and fail("Locked pdf");
+	if (parser.isSet(batchOption)) {
+		arguments.length()==3 or fail("Batch mode requires input.pdf, data.yaml and output.pdf");
+		int queueDepth = parser.value(queueDepthOption).toInt();
+		queueDepth > 0 or fail("Queue depth must be a positive number of records");
+		return batchFill(inputpdf, arguments[1], arguments[2],
+			queueDepth,
+			parser.isSet(radioGroupsOption),
+			budget,
+			parser.value(statsOption));
+	}
 
-	stage("Looking for form fields");
-	FieldTree fieldTree;
-	for (unsigned page=0; true; page++) {
-		Poppler::Page* pdfPage = document->page(page);  // Document starts at page 0
-		if (pdfPage == 0) break;
-		auto fields = pdfPage->formFields();
-		for (auto field : fields) {
-			fieldTree.add(field->fullyQualifiedName(), field);
+	Extractor extract = parser.isSet(schemaOption)? exportSchema : extractYamlFromPdf;
+
+	// Attachments are not cached, so --extract-files bypasses the cache
+	if (parser.isSet(cacheOption) and arguments.length()<3
+		and not parser.isSet(extractFilesOption)) {
+		ExtractionCache cache(parser.value(cacheOption),
+			parser.value(cacheSizeOption).toLongLong()*1024*1024);
+		std::string options = fmt::format("{} cache-format={} schema={} radio-groups={}",
+			app.applicationVersion(),
+			ExtractionCache::format,
+			parser.isSet(schemaOption),
+			parser.isSet(radioGroupsOption));
+		std::ofstream outyaml;
+		if (arguments.length()==2) {
+			outyaml.open(arguments[1].toStdString().c_str());
 		}
+		int result = cachedExtract(cache, inputpdf, options,
+			parser.isSet(radioGroupsOption),
+			parser.value(jobsOption).toUInt(), extract,
+			arguments.length()==2? outyaml : std::cout);
+		cache.persistCounters();
+		writeStats(parser.value(statsOption), [&](YAML::Emitter & out) {
+			cache.report(out);
+		});
+		return result;
 	}
+
+	FormDocument form;
+	// Fill needs all fields in the document being saved
+	loadForm(form, inputpdf, parser.isSet(radioGroupsOption),
+		arguments.length()<3? parser.value(jobsOption).toUInt() : 1);
+	FieldTree & fieldTree = form.fields();
 	switch (arguments.length()) {
 		case 1: {
-			extractYamlFromPdf(fieldTree, std::cout);
+			extract(fieldTree, std::cout);
 		}
 		break;
 		case 2: {
 			std::ofstream outyaml(arguments[1].toStdString().c_str());
-			extractYamlFromPdf(fieldTree, outyaml);
+			extract(fieldTree, outyaml);
 		}
 		break;
 		case 3: {
@@ -457,13 +3356,23 @@ int main(int argc, char**argv)
 				fillPdfWithYaml(fieldTree, inyaml);
 			}
 			stage("Saving filled pdf as {}", arguments[2]);
-			auto converter = std::unique_ptr<Poppler::PDFConverter>(document->pdfConverter());
-			converter->setOutputFileName(arguments[2]);
-			converter->setPDFOptions(Poppler::PDFConverter::WithChanges);
-			converter->convert()
+			form.save(arguments[2])
 				or fail("Error saving file {}", arguments[2]);
+			if (parser.isSet(embedFilesOption)) {
+				std::vector<Attachment> attachments;
+				fieldTree.fileSelections(attachments);
+				stage("Embedding {} files", attachments.size());
+				if (not embedFiles(arguments[2], attachments)) {
+					// Not to be taken for a complete output
+					std::remove(arguments[2].toStdString().c_str());
+					fail("Error embedding files into {}", arguments[2]);
+				}
+			}
 		}
 	}
+	if (arguments.length()<3 and parser.isSet(extractFilesOption)) {
+		extractAttachments(inputpdf, parser.value(extractFilesOption));
+	}
 	return 0;
 }
 
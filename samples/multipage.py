@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""
+Generates multipage.pdf, a three page form with fields on every page,
+a field level whose children are on different pages, and a radio group
+with a button on each page. Used to check parallel page scans.
+"""
+
+objects = []
+
+def add(body):
+	objects.append(body)
+	return len(objects)
+
+def ref(number):
+	return "{} 0 R".format(number)
+
+def appearance():
+	return add("<< /Type /XObject /Subtype /Form /BBox [0 0 20 20] /Length 0 >>\nstream\n\nendstream")
+
+catalog = add(None)
+pagesNode = add(None)
+font = add("<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica /Encoding /WinAnsiEncoding >>")
+
+pages = [add(None) for page in range(3)]
+annotations = [[] for page in pages]
+
+def widget(page, fields, rect):
+	fields = "<< /Type /Annot /Subtype /Widget /P {} /Rect [{}] /F 4 {} >>".format(
+		ref(pages[page]), rect, fields)
+	number = add(fields)
+	annotations[page].append(number)
+	return number
+
+def textField(page, name, value, parent=None):
+	return widget(page,
+		"/FT /Tx /T ({0}) /TU ({0}) /V ({1}) /DA (/Helv 10 Tf 0 g)".format(name, value)
+		+ (" /Parent {}".format(ref(parent)) if parent else ""),
+		"50 700 250 720")
+
+page1Text = textField(0, "Page1Text", "first")
+page3Text = textField(2, "Page3Text", "third")
+
+level = add(None)
+levelA = textField(0, "A", "a", level)
+levelB = textField(2, "B", "b", level)
+objects[level-1] = "<< /T (Level) /TU (Level) /Kids [{} {}] >>".format(ref(levelA), ref(levelB))
+
+check = widget(1,
+	"/FT /Btn /T (Page2Check) /TU (Page2Check) /V /Yes /AS /Yes"
+	" /AP << /N << /Yes {} /Off {} >> >>".format(ref(appearance()), ref(appearance())),
+	"50 650 70 670")
+
+radio = add(None)
+buttons = []
+for page, state in enumerate(["One", "Two", "Three"]):
+	buttons.append(widget(page,
+		"/Parent {} /AS /{} /AP << /N << /{} {} /Off {} >> >>".format(
+			ref(radio), state if state == "Two" else "Off",
+			state, ref(appearance()), ref(appearance())),
+		"50 600 70 620"))
+objects[radio-1] = "<< /FT /Btn /Ff 49152 /T (Choice) /TU (Choice) /V /Two /Kids [{}] >>".format(
+	" ".join(ref(button) for button in buttons))
+
+for page, number in enumerate(pages):
+	content = add("<< /Length 0 >>\nstream\n\nendstream")
+	objects[number-1] = (
+		"<< /Type /Page /Parent {} /MediaBox [0 0 612 792] /Contents {}"
+		" /Annots [{}] >>".format(ref(pagesNode), ref(content),
+			" ".join(ref(annotation) for annotation in annotations[page])))
+
+objects[pagesNode-1] = "<< /Type /Pages /Count {} /Kids [{}] >>".format(
+	len(pages), " ".join(ref(page) for page in pages))
+objects[catalog-1] = (
+	"<< /Type /Catalog /Pages {} /AcroForm << /Fields [{}]"
+	" /NeedAppearances true /DA (/Helv 0 Tf 0 g) /DR << /Font << /Helv {} >> >> >> >>".format(
+		ref(pagesNode),
+		" ".join(ref(field) for field in [page1Text, level, check, radio, page3Text]),
+		ref(font)))
+
+output = b"%PDF-1.4\n"
+offsets = []
+for number, body in enumerate(objects, 1):
+	offsets.append(len(output))
+	output += "{} 0 obj\n{}\nendobj\n".format(number, body).encode("latin-1")
+xref = len(output)
+output += "xref\n0 {}\n0000000000 65535 f \n".format(len(objects)+1).encode()
+for offset in offsets:
+	output += "{:010d} 00000 n \n".format(offset).encode()
+output += "trailer\n<< /Size {} /Root {} >>\nstartxref\n{}\n%%EOF\n".format(
+	len(objects)+1, ref(catalog), xref).encode()
+
+with open(__file__.replace(".py", ".pdf"), "wb") as pdf:
+	pdf.write(output)